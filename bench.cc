@@ -0,0 +1,964 @@
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QPair>
+#include <QStringList>
+#include <QtCrypto>
+#include <QUdpSocket>
+#include <QVariantMap>
+
+#include "bench.hh"
+#include "blockindex.hh"
+#include "codec.hh"
+#include "netio.hh"
+#include "peertable.hh"
+#include "rumorqueue.hh"
+#include "rumorstore.hh"
+#include "searchindex.hh"
+#include "sha1.hh"
+#include "trickle.hh"
+
+// Keeps the compiler from optimizing away work whose result we never use.
+static volatile qint64 benchSink;
+
+static QList<QVariantMap> sampleMessages() {
+  QList<QVariantMap> list;
+
+  QVariantMap rumor;
+  rumor.insert("Origin", "aefijaw123456789");
+  rumor.insert("SeqNo", (quint32) 42);
+  rumor.insert("ChatText", "hello there, how is everyone doing today?");
+  rumor.insert("LastIP", (quint32) 0x7F000001);
+  rumor.insert("LastPort", (quint32) 32768);
+  list.append(rumor);
+
+  QVariantMap route;
+  route.insert("Origin", "aefijaw123456789");
+  route.insert("SeqNo", (quint32) 43);
+  list.append(route);
+
+  QVariantMap want;
+  for (int i = 0; i < 16; ++i) {
+    want.insert("aefijaw" + QString::number(1000000 + i), (quint32) i + 1);
+  }
+  QVariantMap status;
+  status.insert("Want", want);
+  list.append(status);
+
+  QVariantMap request;
+  request.insert("Dest", "aefijaw123456789");
+  request.insert("Origin", "aefijaw987654321");
+  request.insert("HopLimit", (quint32) 10);
+  request.insert("BlockRequest", QByteArray(20, 'h'));
+  list.append(request);
+
+  QVariantMap reply;
+  reply.insert("Dest", "aefijaw987654321");
+  reply.insert("Origin", "aefijaw123456789");
+  reply.insert("HopLimit", (quint32) 10);
+  reply.insert("BlockReply", QByteArray(20, 'h'));
+  reply.insert("Data", QByteArray(8192, 'd'));
+  list.append(reply);
+
+  QVariantMap search;
+  search.insert("Origin", "aefijaw123456789");
+  search.insert("Search", "notes.txt");
+  search.insert("Budget", (quint32) 4);
+  list.append(search);
+
+  return list;
+}
+
+static void benchCodecFormat(const QString& label,
+                             const QList<QVariantMap>& msgs, bool legacy) {
+  const int iterations = 20000;
+  QList<QByteArray> encoded;
+  qint64 bytes = 0;
+  for (const QVariantMap& m : msgs) {
+    QByteArray a = legacy ? WireCodec::encodeLegacy(m) : WireCodec::encode(m);
+    bytes += a.size();
+    encoded.append(a);
+  }
+
+  QElapsedTimer t;
+  t.start();
+  for (int i = 0; i < iterations; ++i) {
+    for (const QVariantMap& m : msgs) {
+      QByteArray a = legacy ? WireCodec::encodeLegacy(m)
+                            : WireCodec::encode(m);
+      benchSink += a.size();
+    }
+  }
+  qint64 encodeNs = t.nsecsElapsed();
+
+  t.restart();
+  for (int i = 0; i < iterations; ++i) {
+    for (const QByteArray& a : encoded) {
+      QVariantMap m;
+      MessageTag tag;
+      WireCodec::decode(a.constData(), a.size(), &m, &tag);
+      benchSink += m.size() + tag;
+    }
+  }
+  qint64 decodeNs = t.nsecsElapsed();
+
+  qint64 count = (qint64) iterations * msgs.size();
+  qDebug() << label.toUtf8().constData()
+           << "bytes/msg:" << (double) bytes / msgs.size()
+           << "encode ns/msg:" << (double) encodeNs / count
+           << "decode ns/msg:" << (double) decodeNs / count;
+}
+
+void benchCodec() {
+  QList<QVariantMap> msgs = sampleMessages();
+  QList<QVariantMap> small;
+  for (const QVariantMap& m : msgs) {
+    if (!m.contains("Data")) {
+      small.append(m);
+    }
+  }
+
+  qDebug() << "codec: all message types";
+  benchCodecFormat("  legacy", msgs, true);
+  benchCodecFormat("  binary", msgs, false);
+  qDebug() << "codec: control messages only (no block data)";
+  benchCodecFormat("  legacy", small, true);
+  benchCodecFormat("  binary", small, false);
+}
+
+// The status / route rumor / vote history mix a node sends each of its
+// peers during a flood.
+static QList<QByteArray> controlMessages() {
+  QList<QByteArray> list;
+  QList<QVariantMap> samples = sampleMessages();
+  list.append(WireCodec::encode(samples.at(1)));  // route rumor
+  list.append(WireCodec::encode(samples.at(2)));  // status
+
+  QVariantMap vh;
+  vh.insert("Tag", 2);
+  vh.insert("vhKey", QStringList("voter,uploader,notes.txt,1"));
+  list.append(WireCodec::encode(vh));
+  return list;
+}
+
+void benchSend() {
+  const int numPeers = 8;
+  const int rounds = 2000;
+
+  // Sink sockets stand in for peers. Nobody reads them; we only measure the
+  // sending side.
+  QUdpSocket sender;
+  sender.bind(QHostAddress::LocalHost, 0);
+  QList<QUdpSocket*> sinks;
+  for (int i = 0; i < numPeers; ++i) {
+    QUdpSocket* sink = new QUdpSocket();
+    sink->bind(QHostAddress::LocalHost, 0);
+    sinks.append(sink);
+  }
+  QList<QByteArray> msgs = controlMessages();
+  qint64 numMessages = (qint64) rounds * numPeers * msgs.size();
+
+  // Before: one writeDatagram() per message.
+  QElapsedTimer t;
+  t.start();
+  for (int r = 0; r < rounds; ++r) {
+    for (QUdpSocket* sink : sinks) {
+      for (const QByteArray& m : msgs) {
+        sender.writeDatagram(m, QHostAddress::LocalHost, sink->localPort());
+      }
+    }
+  }
+  qint64 ns = t.nsecsElapsed();
+  qDebug() << "send: writeDatagram per message"
+           << "msgs/sec:" << numMessages * 1e9 / ns
+           << "packets/sec:" << numMessages * 1e9 / ns
+           << "syscalls:" << numMessages;
+
+  // After: queue a round's worth, coalesce per peer, flush in bulk.
+  SendQueue queue(&sender);
+  t.restart();
+  for (int r = 0; r < rounds; ++r) {
+    for (QUdpSocket* sink : sinks) {
+      for (const QByteArray& m : msgs) {
+        queue.enqueue(m, true, QHostAddress::LocalHost, sink->localPort());
+      }
+    }
+    queue.flush();
+  }
+  ns = t.nsecsElapsed();
+  qDebug() << "send: batched + coalesced"
+           << "msgs/sec:" << numMessages * 1e9 / ns
+           << "packets/sec:" << queue.datagrams * 1e9 / ns
+           << "syscalls:" << queue.syscalls;
+
+  qDeleteAll(sinks);
+}
+
+static QByteArray randomBytes(int n) {
+  QByteArray a(n, Qt::Uninitialized);
+  for (int i = 0; i < n; ++i) {
+    a[i] = (char) (rand() & 0xFF);
+  }
+  return a;
+}
+
+// The block lookup NetSocket::findBlock() used to do: every 20-byte slot of
+// every shared metafile, compared byte by byte.
+static bool scanForBlock(const QList< QPair<QString, QByteArray> >& share,
+                         const QByteArray& blockHash, BlockLocation* location) {
+  for (const QPair<QString, QByteArray>& file : share) {
+    QByteArray metafile = file.second;
+    int numBlocks = metafile.length() / 20;
+    for (int i = 0; i < numBlocks; ++i) {
+      bool match = true;
+      for (int j = 0; j < 20 && match; ++j) {
+        match = metafile.at(20 * i + j) == blockHash.at(j);
+      }
+      if (match) {
+        location->fileName = file.first;
+        location->index = i;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void benchBlockIndex() {
+  // 100 files of 1000 blocks each (about 800 MB worth of 8 KB blocks).
+  const int numFiles = 100;
+  const int blocksPerFile = 1000;
+  const int lookups = 100000;
+  const int scanLookups = 200;
+
+  QList< QPair<QString, QByteArray> > share;
+  QList<QByteArray> hashes;
+  for (int f = 0; f < numFiles; ++f) {
+    QByteArray metafile = randomBytes(20 * blocksPerFile);
+    share.append(qMakePair("file" + QString::number(f), metafile));
+    for (int i = 0; i < blocksPerFile; ++i) {
+      hashes.append(metafile.mid(20 * i, 20));
+    }
+  }
+  // Requests for blocks we don't have cost a full scan too.
+  for (int i = 0; i < hashes.size() / 10; ++i) {
+    hashes.append(randomBytes(20));
+  }
+
+  QElapsedTimer t;
+  t.start();
+  BlockIndex index;
+  for (const QPair<QString, QByteArray>& file : share) {
+    MerklePage root;
+    root.hash = randomBytes(20);
+    root.data = file.second;
+    index.addFile(file.first, QList<MerklePage>() << root, file.second);
+  }
+  qint64 buildNs = t.nsecsElapsed();
+
+  BlockLocation location;
+  t.restart();
+  for (int i = 0; i < scanLookups; ++i) {
+    benchSink += scanForBlock(share, hashes.at(rand() % hashes.size()),
+                              &location);
+  }
+  qint64 scanNs = t.nsecsElapsed();
+
+  t.restart();
+  for (int i = 0; i < lookups; ++i) {
+    benchSink += index.findBlock(hashes.at(rand() % hashes.size()),
+                                 &location);
+  }
+  qint64 indexNs = t.nsecsElapsed();
+
+  qDebug() << "blockindex: shared blocks:" << index.blockCount()
+           << "build ms:" << buildNs / 1e6;
+  qDebug() << "  metafile scan  ns/request:" << (double) scanNs / scanLookups;
+  qDebug() << "  hash index     ns/request:" << (double) indexNs / lookups;
+}
+
+static void benchHashPass(const char* label, const QByteArray& data) {
+  const int numBlocks = data.size() / 8192;
+  QByteArray metafile(20 * numBlocks, Qt::Uninitialized);
+
+  // Indexing: one batch call per file chunk, as HashChunkJob does.
+  QElapsedTimer t;
+  t.start();
+  Sha1::hashBlocks(data.constData(), data.size(), 8192, metafile.data());
+  qint64 indexNs = t.nsecsElapsed();
+
+  // Verification: one call per received block.
+  t.restart();
+  for (int i = 0; i < numBlocks; ++i) {
+    benchSink += Sha1::hash(QByteArray::fromRawData(
+        data.constData() + 8192 * i, 8192)).at(0);
+  }
+  qint64 verifyNs = t.nsecsElapsed();
+
+  qDebug() << label << "index GB/s:" << (double) data.size() / indexNs
+           << "verify GB/s:" << (double) data.size() / verifyNs;
+}
+
+void benchHash() {
+  // 64 MB of 8 KB blocks.
+  QByteArray data = randomBytes(64 << 20);
+  const int numBlocks = data.size() / 8192;
+
+  // What every hash used to cost: a QCA::Hash per block.
+  QCA::Initializer qcainit;
+  QElapsedTimer t;
+  t.start();
+  for (int i = 0; i < numBlocks; ++i) {
+    benchSink += QCA::Hash("sha1").hash(QByteArray::fromRawData(
+        data.constData() + 8192 * i, 8192)).toByteArray().at(0);
+  }
+  qint64 qcaNs = t.nsecsElapsed();
+  qDebug() << "hash: QCA::Hash per block GB/s:" << (double) data.size() / qcaNs;
+
+  bool accelerated = Sha1::accelerated();
+  Sha1::setAccelerated(false);
+  benchHashPass("hash: portable", data);
+  Sha1::setAccelerated(true);
+  if (Sha1::accelerated()) {
+    benchHashPass("hash: SHA extensions", data);
+  } else {
+    qDebug() << "hash: no SHA extensions on this CPU";
+  }
+  Sha1::setAccelerated(accelerated);
+}
+
+// What handleStatusMessage() does for a peer that's up to date, with the
+// old per-origin vectors: each one was copied on every status.
+static qint64 statusPassVectors(
+    const std::map< const QString, std::vector<QString> >& messages,
+    const QVariantMap& want) {
+  qint64 sum = 0;
+  for (std::map< const QString, std::vector<QString> >::const_iterator it =
+           messages.begin(); it != messages.end(); ++it) {
+    std::vector<QString> copy = messages.at(it->first);
+    if (!want.contains(it->first)) {
+      sum += copy.size();
+    }
+    sum += want.value(it->first).toUInt();
+  }
+  return sum;
+}
+
+static qint64 statusPassStore(const RumorStore& store,
+                              const QVariantMap& want) {
+  qint64 sum = 0;
+  for (int i = 0; i < store.originCount(); ++i) {
+    sum += store.count(i);
+    sum += want.value(store.origin(i)).toUInt();
+  }
+  return sum;
+}
+
+void benchRumorStore() {
+  // 1000 origins; one rumor in ten is a chat message, the rest are route
+  // rumors.
+  const int numOrigins = 1000;
+  const int statusPasses = 20;
+  QStringList origins;
+  for (int i = 0; i < numOrigins; ++i) {
+    origins.append("origin" + QString::number(1000000 + i));
+  }
+  QString chat("hello there, how is everyone doing today?");
+
+  std::map< const QString, std::vector<QString> > vectors;
+  RumorStore store;
+  qint64 total = 0;
+  for (int target = 10000; target <= 1000000; target *= 10) {
+    for (; total < target; ++total) {
+      const QString& origin = origins.at(total % numOrigins);
+      QString text = (total % 10 == 0) ? chat : QString();
+      vectors[origin].push_back(text);
+      store.append(origin, text);
+    }
+    QVariantMap want;
+    for (int i = 0; i < store.originCount(); ++i) {
+      want.insert(store.origin(i), store.count(i) + 1);
+    }
+
+    QElapsedTimer t;
+    t.start();
+    for (int i = 0; i < statusPasses; ++i) {
+      benchSink += statusPassVectors(vectors, want);
+    }
+    qint64 vectorNs = t.nsecsElapsed();
+    t.restart();
+    for (int i = 0; i < statusPasses; ++i) {
+      benchSink += statusPassStore(store, want);
+    }
+    qint64 storeNs = t.nsecsElapsed();
+
+    qDebug() << "rumors:" << total
+             << "store bytes/rumor:" << (double) store.bytes() / total;
+    qDebug() << "  status with vector copies us:"
+             << vectorNs / 1e3 / statusPasses;
+    qDebug() << "  status with rumor store   us:"
+             << storeNs / 1e3 / statusPasses;
+  }
+}
+
+void benchStatus() {
+  // A status goes to a peer for every rumor accepted; between two rumors
+  // a node typically sends several (to the rumor's sender, to the peer it
+  // forwards to, on anti-entropy ticks).
+  const int sendsPerRumor = 4;
+  const int rumorsPerOrigin = 3;
+
+  for (int numOrigins = 10; numOrigins <= 10000; numOrigins *= 10) {
+    RumorStore store;
+    for (int i = 0; i < numOrigins; ++i) {
+      QString origin = "origin" + QString::number(1000000 + i);
+      for (int n = 0; n < rumorsPerOrigin; ++n) {
+        store.append(origin, QString());
+      }
+    }
+    int rounds = qMax(20, 200000 / numOrigins);
+
+    // Before: the Want map rebuilt from every origin and encoded per send.
+    QElapsedTimer t;
+    t.start();
+    qint64 bytes = 0;
+    for (int r = 0; r < rounds; ++r) {
+      for (int s = 0; s < sendsPerRumor; ++s) {
+        QVariantMap want;
+        for (int i = 0; i < store.originCount(); ++i) {
+          want.insert(store.origin(i), store.count(i) + 1);
+        }
+        QVariantMap status;
+        status.insert("Want", want);
+        bytes = WireCodec::encode(status).size();
+        benchSink += bytes;
+      }
+    }
+    qint64 rebuildNs = t.nsecsElapsed();
+
+    // After: the Want map is updated per rumor and the encoding reused
+    // until the next one.
+    QVariantMap want;
+    for (int i = 0; i < store.originCount(); ++i) {
+      want.insert(store.origin(i), store.count(i) + 1);
+    }
+    t.restart();
+    for (int r = 0; r < rounds; ++r) {
+      QString origin = store.origin(r % numOrigins);
+      want.insert(origin, want.value(origin).toUInt() + 1);
+      QVariantMap status;
+      status.insert("Want", want);
+      QByteArray cached = WireCodec::encode(status);
+      for (int s = 0; s < sendsPerRumor; ++s) {
+        benchSink += cached.size();
+      }
+    }
+    qint64 cachedNs = t.nsecsElapsed();
+
+    // What an anti-entropy round costs two peers that are in sync.
+    QVariantMap digest;
+    digest.insert("Digest", store.digest());
+    digest.insert("Origins", (quint32) store.originCount());
+    int digestBytes = WireCodec::encode(digest).size();
+
+    qint64 sends = (qint64) rounds * sendsPerRumor;
+    qDebug() << "status: origins:" << numOrigins << "bytes:" << bytes
+             << "digest bytes:" << digestBytes;
+    qDebug() << "  rebuilt per send  us/status:" << rebuildNs / 1e3 / sends;
+    qDebug() << "  incremental       us/status:" << cachedNs / 1e3 / sends;
+  }
+}
+
+// A simulated network for benchGossip: SIM_NODES nodes, each peered with
+// about 2 * SIM_DEGREE others, SIM_DEAD_PERCENT of them dead. Time is
+// simulated; a datagram takes SIM_LATENCY_MS. One rumor starts at a live
+// node after SIM_WARMUP_MS, once the failure detectors have settled.
+#define SIM_NODES 200
+#define SIM_DEGREE 8
+#define SIM_DEAD_PERCENT 20
+#define SIM_LATENCY_MS 10
+#define SIM_AE_MS 10000
+#define SIM_WARMUP_MS 30000
+#define SIM_LIMIT_MS 300000
+
+enum SimEventKind {
+  SIM_PROBE_TICK,
+  SIM_PROBE,
+  SIM_PROBE_ACK,
+  SIM_RUMOR,
+  SIM_STATUS,
+  SIM_RUMOR_TIMEOUT,
+  SIM_AE_TICK,
+  SIM_AE
+};
+
+class SimEvent {
+public:
+  SimEventKind kind;
+  // The node that handles it, and the one it came from.
+  int node;
+  int from;
+  // Which send a timeout is for.
+  quint64 serial;
+};
+
+class SimNode {
+public:
+  // Peers are other nodes on localhost, with the node's index as the port.
+  PeerTable table;
+  bool dead;
+  bool informed;
+  // The peer the rumor is waiting on, or NULL.
+  Peer* target;
+  quint64 serial;
+  int tries;
+};
+
+// Runs the same rumormongering and anti-entropy the engine does, choosing
+// peers either from every peer (the old getRandomPeer) or through the
+// failure detector.
+class GossipSim {
+public:
+  GossipSim(bool detect);
+  ~GossipSim();
+
+  // Milliseconds from the rumor's start until every live node has it, or -1
+  // if that takes over SIM_LIMIT_MS.
+  qint64 run();
+
+  // Rumors and anti-entropy statuses sent to dead nodes, and probes sent
+  // to any node.
+  quint64 wasted;
+  quint64 probes;
+
+private:
+  Peer* pick(SimNode* node);
+  void monger(int n, qint64 now, int tries);
+  void send(qint64 now, SimEventKind kind, int to, int from);
+  void schedule(qint64 at, SimEventKind kind, int node, int from,
+                quint64 serial = 0);
+  void handle(qint64 now, const SimEvent& e);
+
+  bool detect;
+  std::vector<SimNode*> nodes;
+  std::multimap<qint64, SimEvent> events;
+  int liveCount;
+  int informedCount;
+};
+
+GossipSim::GossipSim(bool detect) : detect(detect) {
+  wasted = 0;
+  probes = 0;
+  liveCount = 0;
+  informedCount = 0;
+  for (int i = 0; i < SIM_NODES; ++i) {
+    SimNode* node = new SimNode();
+    node->dead = (rand() % 100 < SIM_DEAD_PERCENT);
+    node->informed = false;
+    node->target = NULL;
+    node->serial = 0;
+    node->tries = 0;
+    nodes.push_back(node);
+    if (!node->dead) {
+      liveCount++;
+    }
+  }
+  // Peering is symmetric, as it is once two nodes have talked.
+  for (int i = 0; i < SIM_NODES; ++i) {
+    for (int d = 0; d < SIM_DEGREE; ++d) {
+      int j = rand() % SIM_NODES;
+      if (j == i) {
+        continue;
+      }
+      nodes[i]->table.findOrAdd(QHostAddress::LocalHost, j, 0);
+      nodes[j]->table.findOrAdd(QHostAddress::LocalHost, i, 0);
+    }
+  }
+  for (int i = 0; i < SIM_NODES; ++i) {
+    if (detect) {
+      schedule(rand() % PEER_PROBE_MS, SIM_PROBE_TICK, i, i);
+    }
+    schedule(rand() % SIM_AE_MS, SIM_AE_TICK, i, i);
+  }
+}
+
+GossipSim::~GossipSim() {
+  for (SimNode* node : nodes) {
+    delete node;
+  }
+}
+
+Peer* GossipSim::pick(SimNode* node) {
+  if (detect) {
+    return node->table.random();
+  }
+  const QVector<Peer*>& all = node->table.all();
+  return all.isEmpty() ? NULL : all.at(rand() % all.size());
+}
+
+void GossipSim::schedule(qint64 at, SimEventKind kind, int node, int from,
+                         quint64 serial) {
+  SimEvent e;
+  e.kind = kind;
+  e.node = node;
+  e.from = from;
+  e.serial = serial;
+  events.insert(std::make_pair(at, e));
+}
+
+void GossipSim::send(qint64 now, SimEventKind kind, int to, int from) {
+  if (nodes[to]->dead) {
+    if (kind != SIM_PROBE) {
+      wasted++;
+    }
+    return;
+  }
+  schedule(now + SIM_LATENCY_MS, kind, to, from);
+}
+
+void GossipSim::monger(int n, qint64 now, int tries) {
+  SimNode* node = nodes[n];
+  Peer* peer = pick(node);
+  if (peer == NULL) {
+    return;
+  }
+  node->target = peer;
+  node->serial++;
+  node->tries = tries;
+  send(now, SIM_RUMOR, peer->port, n);
+  schedule(now + RUMOR_TIMEOUT_MS, SIM_RUMOR_TIMEOUT, n, n, node->serial);
+}
+
+void GossipSim::handle(qint64 now, const SimEvent& e) {
+  SimNode* node = nodes[e.node];
+  if (node->dead) {
+    return;
+  }
+  if (e.from != e.node) {
+    node->table.heardFrom(QHostAddress::LocalHost, e.from, now);
+  }
+  switch (e.kind) {
+    case SIM_PROBE_TICK: {
+      QList<Peer*> due = node->table.probe(now);
+      for (Peer* peer : due) {
+        probes++;
+        send(now, SIM_PROBE, peer->port, e.node);
+      }
+      schedule(now + PEER_PROBE_MS, SIM_PROBE_TICK, e.node, e.node);
+      break;
+    }
+    case SIM_PROBE:
+      send(now, SIM_PROBE_ACK, e.from, e.node);
+      break;
+    case SIM_PROBE_ACK:
+      // Hearing from the peer was all it took.
+      break;
+    case SIM_RUMOR:
+      if (!node->informed) {
+        node->informed = true;
+        informedCount++;
+        monger(e.node, now, 1);
+      }
+      send(now, SIM_STATUS, e.from, e.node);
+      break;
+    case SIM_STATUS:
+      if (node->target != NULL && node->target->port == e.from) {
+        node->target = NULL;
+        if (rand() % 2 == 0) {
+          monger(e.node, now, 1);
+        }
+      }
+      break;
+    case SIM_RUMOR_TIMEOUT:
+      if (node->target != NULL && node->serial == e.serial) {
+        if (detect) {
+          node->table.suspect(node->target, now);
+        }
+        node->target = NULL;
+        if (node->tries < RUMOR_MAX_TRIES) {
+          monger(e.node, now, node->tries + 1);
+        }
+      }
+      break;
+    case SIM_AE_TICK: {
+      Peer* peer = pick(node);
+      if (peer != NULL) {
+        send(now, SIM_AE, peer->port, e.node);
+      }
+      schedule(now + SIM_AE_MS, SIM_AE_TICK, e.node, e.node);
+      break;
+    }
+    case SIM_AE: {
+      // Whoever is behind gets the rumor in the exchange that follows.
+      SimNode* other = nodes[e.from];
+      if (other->informed && !node->informed) {
+        schedule(now + 2 * SIM_LATENCY_MS, SIM_RUMOR, e.node, e.from);
+      } else if (node->informed && !other->informed) {
+        send(now, SIM_RUMOR, e.from, e.node);
+      } else {
+        send(now, SIM_STATUS, e.from, e.node);
+      }
+      break;
+    }
+  }
+}
+
+qint64 GossipSim::run() {
+  int first;
+  do {
+    first = rand() % SIM_NODES;
+  } while (nodes[first]->dead);
+
+  qint64 now = 0;
+  bool started = false;
+  while (!events.empty()) {
+    std::multimap<qint64, SimEvent>::iterator it = events.begin();
+    if (!started && it->first >= SIM_WARMUP_MS) {
+      started = true;
+      now = SIM_WARMUP_MS;
+      nodes[first]->informed = true;
+      informedCount++;
+      monger(first, now, 1);
+      continue;
+    }
+    now = it->first;
+    SimEvent e = it->second;
+    events.erase(it);
+    if (now > SIM_WARMUP_MS + SIM_LIMIT_MS) {
+      break;
+    }
+    handle(now, e);
+    if (started && informedCount == liveCount) {
+      return now - SIM_WARMUP_MS;
+    }
+  }
+  return -1;
+}
+
+void benchGossip() {
+  const int trials = 20;
+  for (int detect = 0; detect <= 1; ++detect) {
+    qint64 total = 0;
+    qint64 worst = 0;
+    int stuck = 0;
+    quint64 wasted = 0;
+    quint64 probes = 0;
+    for (int trial = 0; trial < trials; ++trial) {
+      // Both variants see the same networks.
+      srand(trial + 1);
+      GossipSim sim(detect);
+      qint64 ms = sim.run();
+      if (ms < 0) {
+        stuck++;
+        ms = SIM_LIMIT_MS;
+      }
+      total += ms;
+      worst = qMax(worst, ms);
+      wasted += sim.wasted;
+      probes += sim.probes;
+    }
+    qDebug() << "gossip:" << SIM_NODES << "nodes," << SIM_DEAD_PERCENT
+             << "% dead," << (detect ? "failure detector" : "any peer");
+    qDebug() << "  ms to converge avg:" << total / trials
+             << "worst:" << worst << "not converged:" << stuck
+             << "sends to dead peers:" << wasted / trials
+             << "probes:" << probes / trials;
+  }
+}
+
+void benchTrickle() {
+  // One node's route rumors over six simulated hours, during which its
+  // neighbourhood changes a dozen times, at random moments.
+  const qint64 span = 6 * 3600 * 1000;
+  const int changes = 12;
+  const qint64 fixedMs = 60000;
+  const int trials = 100;
+
+  quint64 fixedSent = 0;
+  quint64 trickleSent = 0;
+  qint64 fixedDelay = 0, fixedWorst = 0;
+  qint64 trickleDelay = 0, trickleWorst = 0;
+  for (int trial = 0; trial < trials; ++trial) {
+    srand(trial + 1);
+    std::vector<qint64> at;
+    for (int i = 0; i < changes; ++i) {
+      at.push_back((qint64) (((double) rand() / RAND_MAX) * span));
+    }
+    std::sort(at.begin(), at.end());
+
+    // Before: every 60 s, whatever happens.
+    fixedSent += span / fixedMs;
+    for (qint64 t : at) {
+      qint64 delay = fixedMs - t % fixedMs;
+      fixedDelay += delay;
+      fixedWorst = qMax(fixedWorst, delay);
+    }
+
+    // After: a Trickle timer, reset by each change.
+    TrickleTimer timer(ROUTE_RUMOR_MIN_MS, ROUTE_RUMOR_MAX_MS, 0);
+    size_t next = 0;
+    qint64 pendingSince = -1;
+    while (timer.due() < span) {
+      if (next < at.size() && at[next] < timer.due()) {
+        timer.reset(at[next]);
+        if (pendingSince < 0) {
+          pendingSince = at[next];
+        }
+        next++;
+        continue;
+      }
+      if (pendingSince >= 0) {
+        qint64 delay = timer.due() - pendingSince;
+        trickleDelay += delay;
+        trickleWorst = qMax(trickleWorst, delay);
+        pendingSince = -1;
+      }
+      timer.fired();
+      trickleSent++;
+    }
+  }
+
+  qDebug() << "trickle:" << changes << "topology changes in 6 h";
+  qDebug() << "  fixed 60 s  route rumors/h:"
+           << (double) fixedSent / trials / 6
+           << "ms until an update avg:" << fixedDelay / (trials * changes)
+           << "worst:" << fixedWorst;
+  qDebug() << "  trickle     route rumors/h:"
+           << (double) trickleSent / trials / 6
+           << "ms until an update avg:" << trickleDelay / (trials * changes)
+           << "worst:" << trickleWorst;
+}
+
+static QString randomWord() {
+  QString word;
+  int length = 3 + rand() % 6;
+  for (int i = 0; i < length; ++i) {
+    word.append(QChar((char) ('a' + rand() % 26)));
+  }
+  return word;
+}
+
+// Times 'reps' runs of 'query' and returns the matches of the last one.
+static int searchPass(const char* label, SearchIndex& index,
+                      const QString& query, int reps) {
+  QElapsedTimer t;
+  t.start();
+  int matches = 0;
+  for (int r = 0; r < reps; ++r) {
+    matches = index.find(query).size();
+  }
+  qDebug() << " " << label << "us/query:" << t.nsecsElapsed() / 1e3 / reps
+           << "matches:" << matches << "query:" << query;
+  return matches;
+}
+
+void benchSearch() {
+  // A million shared files, each named with three words from a 20000-word
+  // vocabulary and an extension, spread over a thousand directories.
+  const int numFiles = 1000000;
+  const int vocabulary = 20000;
+  const char* const extensions[] = { "txt", "pdf", "mp3", "jpg", "doc",
+                                     "mkv" };
+
+  srand(1);
+  QVector<QString> words;
+  for (int i = 0; i < vocabulary; ++i) {
+    words.append(randomWord());
+  }
+  QStringList fileNames;
+  for (int i = 0; i < numFiles; ++i) {
+    fileNames.append("/home/share/dir" + QString::number(i % 1000) + "/"
+                     + words.at(rand() % vocabulary) + "_"
+                     + words.at(rand() % vocabulary) + "-"
+                     + words.at(rand() % vocabulary) + "."
+                     + extensions[rand() % 6]);
+  }
+
+  QElapsedTimer t;
+  t.start();
+  SearchIndex index;
+  for (const QString& fileName : fileNames) {
+    index.addFile(fileName);
+  }
+  qint64 buildNs = t.nsecsElapsed();
+  qDebug() << "search: files:" << index.fileCount()
+           << "tokens:" << index.tokenCount()
+           << "build ms:" << buildNs / 1e6;
+
+  QString a = words.at(7);
+  QString b = words.at(42);
+  searchPass("keyword      ", index, a, 1000);
+  searchPass("and          ", index, a + " txt", 1000);
+  searchPass("or           ", index, a + " or " + b, 1000);
+  searchPass("prefix       ", index, b.left(3) + "*", 100);
+  searchPass("regex, prefix", index, a + "_.*\\.txt", 100);
+  searchPass("regex, capped", index, ".*-" + b + "\\..*", 3);
+
+  // Before: a fresh QRegExp, and every name split, per request.
+  QString pattern = a + "_.*\\.txt";
+  const int scans = 3;
+  t.restart();
+  int matches = 0;
+  for (int r = 0; r < scans; ++r) {
+    QRegExp regex(pattern);
+    matches = 0;
+    for (const QString& fileName : fileNames) {
+      if (regex.exactMatch(fileName.split('/').last())) {
+        matches++;
+      }
+    }
+  }
+  qDebug() << "  full scan     us/query:" << t.nsecsElapsed() / 1e3 / scans
+           << "matches:" << matches << "query:" << pattern;
+}
+
+int runBenchmark(const QString& name) {
+  bool all = (name == "all");
+  bool ran = false;
+  if (all || name == "codec") {
+    benchCodec();
+    ran = true;
+  }
+  if (all || name == "send") {
+    benchSend();
+    ran = true;
+  }
+  if (all || name == "blockindex") {
+    benchBlockIndex();
+    ran = true;
+  }
+  if (all || name == "rumors") {
+    benchRumorStore();
+    ran = true;
+  }
+  if (all || name == "status") {
+    benchStatus();
+    ran = true;
+  }
+  if (all || name == "hash") {
+    benchHash();
+    ran = true;
+  }
+  if (all || name == "gossip") {
+    benchGossip();
+    ran = true;
+  }
+  if (all || name == "search") {
+    benchSearch();
+    ran = true;
+  }
+  if (all || name == "trickle") {
+    benchTrickle();
+    ran = true;
+  }
+
+  if (!ran) {
+    qDebug() << "Unknown benchmark:" << name;
+    return 1;
+  }
+  return 0;
+}
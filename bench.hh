@@ -0,0 +1,21 @@
+#ifndef PEERSTER_BENCH_HH
+#define PEERSTER_BENCH_HH
+
+#include <QString>
+
+// Micro-benchmarks, run with "./peerster -bench <name>" (or "-bench all").
+// They print their results with qDebug() and don't touch the network state
+// of a real node.
+int runBenchmark(const QString& name);
+
+void benchBlockIndex();
+void benchCodec();
+void benchGossip();
+void benchHash();
+void benchRumorStore();
+void benchSearch();
+void benchSend();
+void benchStatus();
+void benchTrickle();
+
+#endif // PEERSTER_BENCH_HH
@@ -0,0 +1,92 @@
+#include "blockindex.hh"
+
+BlockIndex::BlockIndex() {
+  numBlocks = 0;
+  numFiles = 0;
+}
+
+void BlockIndex::addFile(const QString& fileName,
+                         const QList<MerklePage>& pages,
+                         const QByteArray& blockHashes) {
+  for (const MerklePage& page : pages) {
+    QHash<QByteArray, SharedPage>::iterator it = this->pages.find(page.hash);
+    if (it != this->pages.end()) {
+      it.value().refs++;
+      continue;
+    }
+    SharedPage shared;
+    shared.data = page.data;
+    shared.refs = 1;
+    this->pages.insert(page.hash, shared);
+  }
+  numFiles++;
+  int count = blockHashes.size() / 20;
+  blocks.reserve(blocks.size() + count);
+  for (int i = 0; i < count; ++i) {
+    BlockLocation location;
+    location.fileName = fileName;
+    location.index = i;
+    blocks[blockHashes.mid(20 * i, 20)].append(location);
+  }
+  numBlocks += count;
+}
+
+void BlockIndex::removeFile(const QString& fileName,
+                            const QList<MerklePage>& pages,
+                            const QByteArray& blockHashes) {
+  for (const MerklePage& page : pages) {
+    QHash<QByteArray, SharedPage>::iterator it = this->pages.find(page.hash);
+    if (it != this->pages.end() && --it.value().refs == 0) {
+      this->pages.erase(it);
+    }
+  }
+  numFiles--;
+  int count = blockHashes.size() / 20;
+  for (int i = 0; i < count; ++i) {
+    QByteArray hash = blockHashes.mid(20 * i, 20);
+    QHash< QByteArray, QList<BlockLocation> >::iterator it = blocks.find(hash);
+    if (it == blocks.end()) {
+      continue;
+    }
+    QList<BlockLocation>& list = it.value();
+    for (int j = 0; j < list.size(); ++j) {
+      if (list.at(j).index == i && list.at(j).fileName == fileName) {
+        list.removeAt(j);
+        numBlocks--;
+        break;
+      }
+    }
+    if (list.isEmpty()) {
+      blocks.erase(it);
+    }
+  }
+}
+
+bool BlockIndex::findBlock(const QByteArray& blockHash,
+                           BlockLocation* location) const {
+  QHash< QByteArray, QList<BlockLocation> >::const_iterator it =
+      blocks.constFind(blockHash);
+  if (it == blocks.constEnd()) {
+    return false;
+  }
+  *location = it.value().first();
+  return true;
+}
+
+bool BlockIndex::findPage(const QByteArray& pageHash,
+                          QByteArray* page) const {
+  QHash<QByteArray, SharedPage>::const_iterator it = pages.constFind(pageHash);
+  if (it == pages.constEnd()) {
+    return false;
+  }
+  *page = it.value().data;
+  return true;
+}
+
+int BlockIndex::blockCount() const {
+  return numBlocks;
+}
+
+int BlockIndex::fileCount() const {
+  return numFiles;
+}
@@ -0,0 +1,56 @@
+#ifndef PEERSTER_BLOCKINDEX_HH
+#define PEERSTER_BLOCKINDEX_HH
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+#include "merkle.hh"
+
+class BlockLocation {
+public:
+  QString fileName;
+  int index;
+};
+
+// An index page and how many times shared files use it. Files with the
+// same content have the same pages.
+class SharedPage {
+public:
+  QByteArray data;
+  int refs;
+};
+
+// Maps the SHA-1 hashes of everything we share to where it lives: index
+// page hashes to their page, block hashes to a file and block index. Files
+// are added and removed one at a time, so a block request is a single hash
+// lookup however much is shared.
+class BlockIndex {
+public:
+  BlockIndex();
+
+  // 'blockHashes' has 20 bytes per block, 'pages' the file's index pages.
+  void addFile(const QString& fileName, const QList<MerklePage>& pages,
+               const QByteArray& blockHashes);
+  // Takes the same arguments the file was added with.
+  void removeFile(const QString& fileName, const QList<MerklePage>& pages,
+                  const QByteArray& blockHashes);
+  // Returns false if no shared file has a block with this hash.
+  bool findBlock(const QByteArray& blockHash, BlockLocation* location) const;
+  // Returns false if no shared file has an index page with this hash.
+  bool findPage(const QByteArray& pageHash, QByteArray* page) const;
+
+  int blockCount() const;
+  int fileCount() const;
+
+private:
+  // A block that's in several files (or several times in one) has several
+  // locations; any of them will do.
+  QHash< QByteArray, QList<BlockLocation> > blocks;
+  QHash<QByteArray, SharedPage> pages;
+  int numBlocks;
+  int numFiles;
+};
+
+#endif // PEERSTER_BLOCKINDEX_HH
@@ -0,0 +1,540 @@
+#include <QDataStream>
+#include <QStringList>
+#include <QtEndian>
+
+#include "codec.hh"
+
+// Field layouts for each tag, in wire order. Optional fields must come last
+// and there can be at most 8 of them per tag (one bit each in the header).
+static const FieldSpec rumorFields[] = {
+  { "Origin",   FIELD_STRING, false },
+  { "SeqNo",    FIELD_U32,    false },
+  { "ChatText", FIELD_STRING, false },
+  { "LastIP",   FIELD_U32,    true  },
+  { "LastPort", FIELD_U16,    true  },
+  { "Hops",     FIELD_U32,    true  }
+};
+
+static const FieldSpec routeRumorFields[] = {
+  { "Origin",   FIELD_STRING, false },
+  { "SeqNo",    FIELD_U32,    false },
+  { "LastIP",   FIELD_U32,    true  },
+  { "LastPort", FIELD_U16,    true  },
+  { "Hops",     FIELD_U32,    true  }
+};
+
+static const FieldSpec statusFields[] = {
+  { "Want", FIELD_WANT_MAP, false }
+};
+
+static const FieldSpec statusDigestFields[] = {
+  { "Digest",  FIELD_BYTES, false },
+  { "Origins", FIELD_U32,   false },
+  { "Probe",   FIELD_U32,   true  }
+};
+
+static const FieldSpec privRumorFields[] = {
+  { "Dest",     FIELD_STRING, false },
+  { "Origin",   FIELD_STRING, false },
+  { "HopLimit", FIELD_U32,    false },
+  { "ChatText", FIELD_STRING, false }
+};
+
+static const FieldSpec cryptoFields[] = {
+  { "Dest",      FIELD_STRING, false },
+  { "Origin",    FIELD_STRING, false },
+  { "HopLimit",  FIELD_U32,    false },
+  { "ChatText",  FIELD_STRING, false },
+  { "N",         FIELD_STRING, false },
+  { "PublicKey", FIELD_STRING, false },
+  { "Crypto",    FIELD_STRING, false }
+};
+
+static const FieldSpec blockRequestFields[] = {
+  { "Dest",         FIELD_STRING, false },
+  { "Origin",       FIELD_STRING, false },
+  { "HopLimit",     FIELD_U32,    false },
+  { "BlockRequest", FIELD_BYTES,  false }
+};
+
+static const FieldSpec blockReplyFields[] = {
+  { "Dest",       FIELD_STRING, false },
+  { "Origin",     FIELD_STRING, false },
+  { "HopLimit",   FIELD_U32,    false },
+  { "BlockReply", FIELD_BYTES,  false },
+  { "Data",       FIELD_BYTES,  false }
+};
+
+static const FieldSpec searchRequestFields[] = {
+  { "Origin", FIELD_STRING, false },
+  { "Search", FIELD_STRING, false },
+  { "Budget", FIELD_U32,    false }
+};
+
+static const FieldSpec searchReplyFields[] = {
+  { "Dest",        FIELD_STRING,       false },
+  { "Origin",      FIELD_STRING,       false },
+  { "HopLimit",    FIELD_U32,          false },
+  { "SearchReply", FIELD_STRING,       false },
+  { "MatchNames",  FIELD_VARIANT_LIST, false },
+  { "MatchIDs",    FIELD_BYTES,        false }
+};
+
+static const FieldSpec voteHistoryFields[] = {
+  { "Tag",   FIELD_I32,         false },
+  { "vhKey", FIELD_STRING_LIST, false }
+};
+
+#define NUM_FIELDS(a) ((int) (sizeof(a) / sizeof(a[0])))
+
+const FieldSpec* WireCodec::schema(MessageTag tag, int* numFields) {
+  switch (tag) {
+    case TAG_RUMOR:
+      *numFields = NUM_FIELDS(rumorFields);
+      return rumorFields;
+    case TAG_ROUTE_RUMOR:
+      *numFields = NUM_FIELDS(routeRumorFields);
+      return routeRumorFields;
+    case TAG_STATUS:
+      *numFields = NUM_FIELDS(statusFields);
+      return statusFields;
+    case TAG_STATUS_DIGEST:
+      *numFields = NUM_FIELDS(statusDigestFields);
+      return statusDigestFields;
+    case TAG_PRIV_RUMOR:
+      *numFields = NUM_FIELDS(privRumorFields);
+      return privRumorFields;
+    case TAG_CRYPTO:
+      *numFields = NUM_FIELDS(cryptoFields);
+      return cryptoFields;
+    case TAG_BLOCK_REQUEST:
+      *numFields = NUM_FIELDS(blockRequestFields);
+      return blockRequestFields;
+    case TAG_BLOCK_REPLY:
+      *numFields = NUM_FIELDS(blockReplyFields);
+      return blockReplyFields;
+    case TAG_SEARCH_REQUEST:
+      *numFields = NUM_FIELDS(searchRequestFields);
+      return searchRequestFields;
+    case TAG_SEARCH_REPLY:
+      *numFields = NUM_FIELDS(searchReplyFields);
+      return searchReplyFields;
+    case TAG_VOTE_HISTORY:
+      *numFields = NUM_FIELDS(voteHistoryFields);
+      return voteHistoryFields;
+    default:
+      *numFields = 0;
+      return NULL;
+  }
+}
+
+const char* WireCodec::tagName(MessageTag tag) {
+  switch (tag) {
+    case TAG_RUMOR:          return "Rumor";
+    case TAG_ROUTE_RUMOR:    return "RouteRumor";
+    case TAG_STATUS:         return "Status";
+    case TAG_PRIV_RUMOR:     return "PrivRumor";
+    case TAG_CRYPTO:         return "Crypto";
+    case TAG_BLOCK_REQUEST:  return "BlockRequest";
+    case TAG_BLOCK_REPLY:    return "BlockReply";
+    case TAG_SEARCH_REQUEST: return "SearchRequest";
+    case TAG_SEARCH_REPLY:   return "SearchReply";
+    case TAG_VOTE_HISTORY:   return "VoteHistory";
+    case TAG_BUNDLE:         return "Bundle";
+    case TAG_STATUS_DIGEST:  return "StatusDigest";
+    default:                 return "Unknown";
+  }
+}
+
+MessageTag WireCodec::classify(const QVariantMap& map) {
+  bool hasText = map.contains("ChatText");
+  bool hasOrigin = map.contains("Origin");
+  bool hasDest = map.contains("Dest");
+  bool hasHopLimit = map.contains("HopLimit");
+  bool hasSeqNo = map.contains("SeqNo");
+  int size = map.size();
+
+  if (size == 4 && hasText && hasOrigin && hasDest && hasHopLimit) {
+    return TAG_PRIV_RUMOR;
+  }
+  if (map.contains("Crypto")) {
+    return TAG_CRYPTO;
+  }
+  if (size == 4 && hasDest && hasOrigin && hasHopLimit
+      && map.contains("BlockRequest")) {
+    return TAG_BLOCK_REQUEST;
+  }
+  if (size == 5 && hasDest && hasOrigin && hasHopLimit
+      && map.contains("BlockReply") && map.contains("Data")) {
+    return TAG_BLOCK_REPLY;
+  }
+  if (size == 6 && hasDest && hasOrigin && hasHopLimit
+      && map.contains("SearchReply") && map.contains("MatchNames")
+      && map.contains("MatchIDs")) {
+    return TAG_SEARCH_REPLY;
+  }
+  if (size == 3 && hasOrigin && map.contains("Search")
+      && map.contains("Budget")) {
+    return TAG_SEARCH_REQUEST;
+  }
+  if (hasText && hasOrigin && hasSeqNo) {
+    return TAG_RUMOR;
+  }
+  if (!hasText && hasOrigin && hasSeqNo) {
+    return TAG_ROUTE_RUMOR;
+  }
+  if (size == 2 && map.contains("vhKey") && map.contains("Tag")) {
+    return TAG_VOTE_HISTORY;
+  }
+  if (size == 1 && map.contains("Want")) {
+    return TAG_STATUS;
+  }
+  if ((size == 2 || (size == 3 && map.contains("Probe")))
+      && map.contains("Digest") && map.contains("Origins")) {
+    return TAG_STATUS_DIGEST;
+  }
+  return TAG_UNKNOWN;
+}
+
+// Appends little-endian fixed-width values to a datagram buffer.
+class WireWriter {
+public:
+  WireWriter(QByteArray* out) : out(out), ok(true) {}
+
+  void u8(quint8 v) {
+    out->append((char) v);
+  }
+
+  void u16(quint16 v) {
+    uchar b[2];
+    qToLittleEndian(v, b);
+    out->append((const char*) b, 2);
+  }
+
+  void u32(quint32 v) {
+    uchar b[4];
+    qToLittleEndian(v, b);
+    out->append((const char*) b, 4);
+  }
+
+  void bytes(const QByteArray& b) {
+    if (b.size() > 0xFFFF) {
+      ok = false;
+      return;
+    }
+    u16((quint16) b.size());
+    out->append(b);
+  }
+
+  QByteArray* out;
+  bool ok;
+};
+
+// Reads values back out of a datagram buffer without copying it. Every read
+// is bounds-checked; once 'ok' goes false all further reads return zero.
+class WireReader {
+public:
+  WireReader(const char* data, int size)
+    : p((const uchar*) data), end((const uchar*) data + size), ok(true) {}
+
+  bool has(int n) {
+    if (!ok || end - p < n) {
+      ok = false;
+    }
+    return ok;
+  }
+
+  quint8 u8() {
+    if (!has(1)) return 0;
+    return *p++;
+  }
+
+  quint16 u16() {
+    if (!has(2)) return 0;
+    quint16 v = qFromLittleEndian<quint16>(p);
+    p += 2;
+    return v;
+  }
+
+  quint32 u32() {
+    if (!has(4)) return 0;
+    quint32 v = qFromLittleEndian<quint32>(p);
+    p += 4;
+    return v;
+  }
+
+  QByteArray bytes() {
+    int n = u16();
+    if (!has(n)) return QByteArray();
+    QByteArray b((const char*) p, n);
+    p += n;
+    return b;
+  }
+
+  QString string() {
+    int n = u16();
+    if (!has(n)) return QString();
+    QString s = QString::fromUtf8((const char*) p, n);
+    p += n;
+    return s;
+  }
+
+  const uchar* p;
+  const uchar* end;
+  bool ok;
+};
+
+static bool writeField(WireWriter* w, const FieldSpec& spec,
+                       const QVariant& v) {
+  bool ok = true;
+  switch (spec.type) {
+    case FIELD_U16: {
+      uint n = v.toUInt(&ok);
+      if (!ok || n > 0xFFFF) return false;
+      w->u16((quint16) n);
+      break;
+    }
+    case FIELD_U32:
+      w->u32(v.toUInt(&ok));
+      break;
+    case FIELD_I32:
+      w->u32((quint32) v.toInt(&ok));
+      break;
+    case FIELD_STRING:
+      w->bytes(v.toString().toUtf8());
+      break;
+    case FIELD_BYTES:
+      w->bytes(v.toByteArray());
+      break;
+    case FIELD_STRING_LIST:
+    case FIELD_VARIANT_LIST: {
+      QStringList list = v.toStringList();
+      if (list.size() > 0xFFFF) return false;
+      w->u16((quint16) list.size());
+      for (const QString& s : list) {
+        w->bytes(s.toUtf8());
+      }
+      break;
+    }
+    case FIELD_WANT_MAP: {
+      QVariantMap want = v.toMap();
+      if (want.size() > 0xFFFF) return false;
+      w->u16((quint16) want.size());
+      for (QVariantMap::const_iterator it = want.constBegin();
+          it != want.constEnd(); ++it) {
+        w->bytes(it.key().toUtf8());
+        w->u32(it.value().toUInt());
+      }
+      break;
+    }
+  }
+  return ok && w->ok;
+}
+
+static QVariant readField(WireReader* r, const FieldSpec& spec) {
+  switch (spec.type) {
+    case FIELD_U16:
+      return (quint32) r->u16();
+    case FIELD_U32:
+      return r->u32();
+    case FIELD_I32:
+      return (qint32) r->u32();
+    case FIELD_STRING:
+      return r->string();
+    case FIELD_BYTES:
+      return r->bytes();
+    case FIELD_STRING_LIST: {
+      QStringList list;
+      int n = r->u16();
+      for (int i = 0; i < n && r->ok; ++i) {
+        list.append(r->string());
+      }
+      return list;
+    }
+    case FIELD_VARIANT_LIST: {
+      QVariantList list;
+      int n = r->u16();
+      for (int i = 0; i < n && r->ok; ++i) {
+        list.append(r->string());
+      }
+      return list;
+    }
+    case FIELD_WANT_MAP: {
+      QVariantMap want;
+      int n = r->u16();
+      for (int i = 0; i < n && r->ok; ++i) {
+        QString origin = r->string();
+        want.insert(origin, r->u32());
+      }
+      return want;
+    }
+  }
+  return QVariant();
+}
+
+bool WireCodec::encodeInto(const QVariantMap& map, MessageTag tag,
+                           QByteArray* out) {
+  int numFields;
+  const FieldSpec* fields = schema(tag, &numFields);
+  if (fields == NULL) {
+    return false;
+  }
+
+  // Every key in the map has to be accounted for by the schema, otherwise
+  // the receiver would see a different map than the one we were given.
+  quint8 optMask = 0;
+  int present = 0;
+  int optBit = 0;
+  for (int i = 0; i < numFields; ++i) {
+    bool has = map.contains(fields[i].key);
+    if (fields[i].optional) {
+      if (has) {
+        optMask |= (1 << optBit);
+      }
+      optBit++;
+    } else if (!has) {
+      return false;
+    }
+    if (has) {
+      present++;
+    }
+  }
+  if (present != map.size()) {
+    return false;
+  }
+
+  int start = out->size();
+  WireWriter w(out);
+  w.u8(WIRE_MAGIC);
+  w.u8(WIRE_VERSION);
+  w.u8((quint8) tag);
+  w.u8(optMask);
+
+  optBit = 0;
+  for (int i = 0; i < numFields; ++i) {
+    if (fields[i].optional && !(optMask & (1 << optBit++))) {
+      continue;
+    }
+    if (!writeField(&w, fields[i], map.value(fields[i].key))) {
+      out->truncate(start);
+      return false;
+    }
+  }
+  return true;
+}
+
+QByteArray WireCodec::encodeLegacy(const QVariantMap& map) {
+  QByteArray a;
+  QDataStream s(&a, QIODevice::WriteOnly);
+  s << map;
+  return a;
+}
+
+QByteArray WireCodec::encode(const QVariantMap& map, MessageTag* tag) {
+  MessageTag t = classify(map);
+  if (tag != NULL) {
+    *tag = t;
+  }
+  QByteArray a;
+  if (!encodeInto(map, t, &a)) {
+    return encodeLegacy(map);
+  }
+  return a;
+}
+
+bool WireCodec::isBundle(const char* data, int size) {
+  return size >= WIRE_HEADER_SIZE && (uchar) data[0] == WIRE_MAGIC
+      && (uchar) data[1] == WIRE_VERSION && (uchar) data[2] == TAG_BUNDLE;
+}
+
+bool WireCodec::appendToBundle(QByteArray* bundle, const QByteArray& message,
+                               int maxSize) {
+  int needed = 2 + message.size();
+  if (bundle->isEmpty()) {
+    needed += WIRE_HEADER_SIZE;
+  }
+  if (bundle->size() + needed > maxSize || message.size() > 0xFFFF) {
+    return false;
+  }
+
+  WireWriter w(bundle);
+  if (bundle->isEmpty()) {
+    w.u8(WIRE_MAGIC);
+    w.u8(WIRE_VERSION);
+    w.u8((quint8) TAG_BUNDLE);
+    w.u8(0);
+  }
+  w.bytes(message);
+  return true;
+}
+
+bool WireCodec::splitBundle(const char* data, int size,
+                            QVector< QPair<const char*, int> >* parts) {
+  if (!isBundle(data, size)) {
+    return false;
+  }
+  WireReader r(data + WIRE_HEADER_SIZE, size - WIRE_HEADER_SIZE);
+  while (r.ok && r.p < r.end) {
+    int n = r.u16();
+    if (!r.has(n)) {
+      break;
+    }
+    const char* part = (const char*) r.p;
+    if (isBundle(part, n)) {
+      return false;
+    }
+    parts->append(qMakePair(part, n));
+    r.p += n;
+  }
+  return r.ok;
+}
+
+bool WireCodec::decode(const char* data, int size, QVariantMap* map,
+                       MessageTag* tag) {
+  if (size >= WIRE_HEADER_SIZE && (uchar) data[0] == WIRE_MAGIC) {
+    return decodeBinary(data, size, map, tag);
+  }
+  return decodeLegacy(data, size, map, tag);
+}
+
+bool WireCodec::decodeBinary(const char* data, int size, QVariantMap* map,
+                             MessageTag* tag) {
+  WireReader r(data, size);
+  r.u8();  // magic
+  if (r.u8() != WIRE_VERSION) {
+    return false;
+  }
+  *tag = (MessageTag) r.u8();
+  quint8 optMask = r.u8();
+
+  int numFields;
+  const FieldSpec* fields = schema(*tag, &numFields);
+  if (fields == NULL) {
+    *tag = TAG_UNKNOWN;
+    return false;
+  }
+
+  int optBit = 0;
+  for (int i = 0; i < numFields && r.ok; ++i) {
+    if (fields[i].optional && !(optMask & (1 << optBit++))) {
+      continue;
+    }
+    map->insert(fields[i].key, readField(&r, fields[i]));
+  }
+
+  // Trailing bytes mean the sender and I disagree on the schema.
+  return r.ok && r.p == r.end;
+}
+
+bool WireCodec::decodeLegacy(const char* data, int size, QVariantMap* map,
+                             MessageTag* tag) {
+  QByteArray buf = QByteArray::fromRawData(data, size);
+  QDataStream str(&buf, QIODevice::ReadOnly);
+  str >> *map;
+  if (str.status() != QDataStream::Ok) {
+    *tag = TAG_UNKNOWN;
+    return false;
+  }
+  *tag = classify(*map);
+  return true;
+}
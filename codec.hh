@@ -0,0 +1,96 @@
+#ifndef PEERSTER_CODEC_HH
+#define PEERSTER_CODEC_HH
+
+#include <QByteArray>
+#include <QPair>
+#include <QVariantMap>
+#include <QVector>
+
+// Every binary datagram starts with WIRE_MAGIC and WIRE_VERSION. A legacy
+// QDataStream-serialized QVariantMap starts with its big-endian entry count,
+// whose first byte is always 0, so the two formats can't be confused.
+#define WIRE_MAGIC 0xB5
+#define WIRE_VERSION 1
+
+// Header: magic, version, tag, bitmask of which optional fields are present.
+#define WIRE_HEADER_SIZE 4
+
+// One tag per message type. The tag is the only thing a receiver needs to
+// look at to know what it got.
+enum MessageTag {
+  TAG_UNKNOWN = 0,
+  TAG_RUMOR,
+  TAG_ROUTE_RUMOR,
+  TAG_STATUS,
+  TAG_PRIV_RUMOR,
+  TAG_CRYPTO,
+  TAG_BLOCK_REQUEST,
+  TAG_BLOCK_REPLY,
+  TAG_SEARCH_REQUEST,
+  TAG_SEARCH_REPLY,
+  TAG_VOTE_HISTORY,
+  TAG_BUNDLE,  // several small messages for the same peer in one datagram
+  TAG_STATUS_DIGEST,  // a fixed-size summary of a status, see RumorStore
+  TAG_COUNT
+};
+
+// How a single field is laid out on the wire. All integers are little-endian
+// and fixed-width; strings are UTF-8. Strings, byte arrays and lists carry a
+// 16-bit length (or count) prefix, which is plenty for a UDP payload.
+enum FieldType {
+  FIELD_U16,
+  FIELD_U32,
+  FIELD_I32,
+  FIELD_STRING,
+  FIELD_BYTES,
+  FIELD_STRING_LIST,  // decoded as QStringList
+  FIELD_VARIANT_LIST, // list of strings, decoded as QVariantList
+  FIELD_WANT_MAP      // origin -> quint32 next wanted seqno
+};
+
+class FieldSpec {
+public:
+  const char* key;
+  FieldType type;
+  bool optional;
+};
+
+class WireCodec {
+public:
+  // Figure out which message type a map represents, using the same rules
+  // (and the same precedence) as the old isX() predicates.
+  static MessageTag classify(const QVariantMap& map);
+
+  // Encode 'map' in the binary format. Maps that don't match a known schema
+  // exactly (unknown tag, extra keys, oversized fields) fall back to the
+  // legacy QDataStream encoding so nothing is ever silently dropped.
+  static QByteArray encode(const QVariantMap& map, MessageTag* tag = NULL);
+  static bool encodeInto(const QVariantMap& map, MessageTag tag,
+                         QByteArray* out);
+  static QByteArray encodeLegacy(const QVariantMap& map);
+
+  // Decode a datagram in either format straight from the receive buffer.
+  // Returns false if the datagram is malformed. On success 'map' holds the
+  // same keys the legacy format would have produced and 'tag' its type.
+  static bool decode(const char* data, int size, QVariantMap* map,
+                     MessageTag* tag);
+
+  // A bundle is a normal header with TAG_BUNDLE followed by any number of
+  // length-prefixed encoded messages. Bundles don't nest.
+  static bool isBundle(const char* data, int size);
+  static bool appendToBundle(QByteArray* bundle, const QByteArray& message,
+                             int maxSize);
+  static bool splitBundle(const char* data, int size,
+                          QVector< QPair<const char*, int> >* parts);
+
+  static const char* tagName(MessageTag tag);
+
+private:
+  static bool decodeBinary(const char* data, int size, QVariantMap* map,
+                           MessageTag* tag);
+  static bool decodeLegacy(const char* data, int size, QVariantMap* map,
+                           MessageTag* tag);
+  static const FieldSpec* schema(MessageTag tag, int* numFields);
+};
+
+#endif // PEERSTER_CODEC_HH
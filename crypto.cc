@@ -1,8 +1,15 @@
 //http://alumni.cs.ucr.edu/~anirban/Anir%20-%20NCW03.pdf
 
+#include <cstdlib>
+
+#include <QDebug>
+#include <QString>
+
 #include "gmp/gmpxx.h"
 #include "gmp/gmp.h"
 
+#include "crypto.hh"
+
 
 // Size of the RSA modulus in bits.
 #define BITSTRENGTH 512
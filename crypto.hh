@@ -0,0 +1,16 @@
+#ifndef PEERSTER_CRYPTO_HH
+#define PEERSTER_CRYPTO_HH
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// RSA encryption of private messages. Keys and messages are decimal strings.
+
+// Return vector is in the form {product, pub_key, priv_key}.
+vector<string> gen_keys();
+string rsa_encrypt(string msg, string pub_key, string prod);
+string rsa_decrypt(string code, string priv_key, string prod);
+
+#endif // PEERSTER_CRYPTO_HH
@@ -0,0 +1,218 @@
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegExp>
+
+#include <unistd.h>
+
+#include "daemon.hh"
+
+HeadlessSink::HeadlessSink(NetSocket* sock) {
+  this->sock = sock;
+}
+
+void HeadlessSink::chatMessageReceived(const QString& text,
+                                       const QString& origin) {
+  qDebug() << "chat" << origin << ":" << text.trimmed();
+}
+
+void HeadlessSink::originDiscovered(const QString& origin) {
+  qDebug() << "new origin" << origin;
+}
+
+void HeadlessSink::privateChannelOpened(const QString& origin) {
+  // Answer with our own key once, like opening a private window would.
+  if (!keysSent.contains(origin)) {
+    keysSent.insert(origin);
+    sock->sendCryptoKeys(origin);
+  }
+}
+
+void HeadlessSink::privateMessageReceived(const QString& origin,
+                                          const QString& text) {
+  qDebug() << "private" << origin << ":" << text;
+}
+
+void HeadlessSink::searchStarted(const QString& query) {
+  qDebug() << "search" << query;
+}
+
+void HeadlessSink::searchResultFound(const QString& fileName, double score) {
+  if (score != -2) {
+    qDebug() << "result" << fileName << score;
+  } else {
+    qDebug() << "result" << fileName << "(no score)";
+  }
+
+  // The engine ignores results that are already downloading.
+  if (!sock->unlocked
+      && QRegExp(generateBTERegexString()).exactMatch(fileName)) {
+    sock->sendDownloadRequest(fileName);
+  }
+}
+
+void HeadlessSink::sharingProgress(const QString& fileName,
+                                   qint64 bytesHashed, qint64 bytesTotal) {
+  if (bytesHashed == bytesTotal) {
+    qDebug() << "shared" << fileName << bytesTotal << "bytes";
+  } else {
+    qDebug() << "hashing" << fileName << bytesHashed << "/" << bytesTotal;
+  }
+}
+
+void HeadlessSink::downloadStarted(const QString& fileName) {
+  qDebug() << "downloading" << fileName;
+}
+
+void HeadlessSink::downloadProgress(const QString& fileName, int blocksDone,
+                                    int blocksTotal) {
+  qDebug() << "progress" << fileName << blocksDone << "/" << blocksTotal;
+}
+
+void HeadlessSink::downloadFailed(const QString& fileName) {
+  qDebug() << "download failed" << fileName;
+}
+
+void HeadlessSink::downloadFinished(const QString& fileName,
+                                    const QString& uploader) {
+  qDebug() << "downloaded" << fileName << "from" << uploader;
+
+  if (!sock->unlocked) {
+    sock->tryUnlock();
+  }
+}
+
+void HeadlessSink::nodeUnlocked() {
+  qDebug() << "unlocked";
+}
+
+ControlServer::ControlServer(NetSocket* sock) {
+  this->sock = sock;
+  server = new QLocalServer(this);
+  connect(server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+}
+
+// The socket lives in a directory only this user can enter, so other local
+// users can't share files or send messages as this node.
+bool ControlServer::listen() {
+  QString dir = QDir::tempPath() + "/peerster-" + QString::number(getuid());
+  QDir().mkpath(dir);
+  QFileInfo info(dir);
+  if (!info.isDir() || info.isSymLink() || info.ownerId() != getuid()
+      || !QFile::setPermissions(dir, QFile::ReadOwner | QFile::WriteOwner
+                                     | QFile::ExeOwner)) {
+    qDebug() << "Control socket directory" << dir << "isn't private";
+    return false;
+  }
+
+  QString name = dir + "/" + QString::number(sock->myPort);
+  if (QFile::exists(name)) {
+    // Only remove a socket nobody answers on; a node that crashed may have
+    // left it behind.
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(500)) {
+      qDebug() << "Control socket" << name << "is in use";
+      return false;
+    }
+    QLocalServer::removeServer(name);
+  }
+  if (!server->listen(name)) {
+    qDebug() << "Control socket" << name << "failed:" << server->errorString();
+    return false;
+  }
+  qDebug() << "Control socket:" << server->fullServerName();
+  return true;
+}
+
+void ControlServer::newConnection() {
+  while (server->hasPendingConnections()) {
+    QLocalSocket* client = server->nextPendingConnection();
+    connect(client, SIGNAL(readyRead()), this, SLOT(readCommands()));
+    connect(client, SIGNAL(disconnected()), client, SLOT(deleteLater()));
+  }
+}
+
+void ControlServer::readCommands() {
+  QLocalSocket* client = qobject_cast<QLocalSocket*>(sender());
+  if (client == NULL) {
+    return;
+  }
+  while (client->canReadLine()) {
+    QString line = QString::fromUtf8(client->readLine().constData()).trimmed();
+    if (!line.isEmpty()) {
+      client->write(execute(line).toUtf8() + "\n");
+    }
+  }
+}
+
+QString ControlServer::execute(const QString& line) {
+  QString cmd = line.section(' ', 0, 0);
+  QString arg = line.section(' ', 1).trimmed();
+
+  if (cmd == "results") {
+    QStringList names;
+    for (ResultMap::iterator it = sock->resultMap->begin();
+         it != sock->resultMap->end(); ++it) {
+      names.append(it->first);
+    }
+    return "ok " + names.join(" ");
+  } else if (cmd == "origins") {
+    return "ok " + QStringList(sock->routes->origins()).join(" ");
+  } else if (cmd == "unlock") {
+    return sock->unlocked || sock->tryUnlock() ? "ok" : "error locked";
+  } else if (cmd == "stats") {
+    sock->logStats();
+    return "ok";
+  } else if (cmd == "transfers") {
+    // <file name>:<blocks received>/<blocks>:<sources>:<total window>;
+    // metafiles count as one block.
+    QStringList list;
+    QList<Transfer*> transfers = sock->transfers->all();
+    for (Transfer* t : transfers) {
+      list.append(QString("%1:%2/%3:%4:%5").arg(t->fileName)
+                  .arg(t->window->received).arg(t->window->numBlocks)
+                  .arg(t->window->sources.size())
+                  .arg((int) t->window->totalWindow()));
+    }
+    return "ok " + list.join(" ");
+  }
+
+  if (arg.isEmpty()) {
+    return "error usage: " + cmd + " <argument>";
+  }
+  if (cmd == "search") {
+    sock->handleSearchRequest(arg);
+    return "ok";
+  } else if (cmd == "download") {
+    if (sock->resultMap->count(arg) == 0) {
+      return "error no such result";
+    }
+    sock->sendDownloadRequest(arg);
+    return "ok";
+  }
+
+  // The rest of the commands need an unlocked node, like their buttons in
+  // the GUI.
+  if (!sock->unlocked) {
+    return "error locked";
+  }
+  if (cmd == "peer") {
+    sock->addPeer(arg);
+  } else if (cmd == "share") {
+    sock->addFile(arg);
+  } else if (cmd == "unshare") {
+    sock->removeFile(arg);
+  } else if (cmd == "msg") {
+    sock->sendChatMessage(arg);
+  } else if (cmd == "pm") {
+    QString origin = arg.section(' ', 0, 0);
+    if (!sock->sendPrivateMessage(origin, arg.section(' ', 1))) {
+      return "error no key for " + origin;
+    }
+  } else {
+    return "error unknown command " + cmd;
+  }
+  return "ok";
+}
@@ -0,0 +1,67 @@
+#ifndef PEERSTER_DAEMON_HH
+#define PEERSTER_DAEMON_HH
+
+#include <QHash>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSet>
+#include <QStringList>
+
+#include "eventsink.hh"
+#include "netsocket.hh"
+
+// Event sink for "-headless" nodes: events are logged instead of drawn.
+// While the node is locked it fetches the barrier-to-entry files by itself,
+// since there is nobody to double-click the search results.
+class HeadlessSink : public EventSink {
+public:
+  HeadlessSink(NetSocket* sock);
+
+  void chatMessageReceived(const QString& text, const QString& origin);
+  void originDiscovered(const QString& origin);
+  void privateChannelOpened(const QString& origin);
+  void privateMessageReceived(const QString& origin, const QString& text);
+  void searchStarted(const QString& query);
+  void searchResultFound(const QString& fileName, double score);
+  void sharingProgress(const QString& fileName, qint64 bytesHashed,
+                       qint64 bytesTotal);
+  void downloadStarted(const QString& fileName);
+  void downloadProgress(const QString& fileName, int blocksDone,
+                        int blocksTotal);
+  void downloadFailed(const QString& fileName);
+  void downloadFinished(const QString& fileName, const QString& uploader);
+  void nodeUnlocked();
+
+  NetSocket* sock;
+  // Origins we've already sent our public key to.
+  QSet<QString> keysSent;
+};
+
+// Line-based control interface on a local socket at
+// "<tmp>/peerster-<uid>/<port>".
+// It lives on the engine's thread, so commands call the engine directly.
+// Each line is a command; each reply is a line starting with "ok" or
+// "error". A search query is keywords joined by "and"/"or", with '*' for a
+// prefix, or a regexp matched against whole file names (see SearchIndex).
+//
+//   peer <host:port>       share <path>       search <query>
+//   download <file name>   msg <text>         pm <origin> <text>
+//   results                origins            unlock
+//   stats                  transfers          unshare <path>
+class ControlServer : public QObject {
+  Q_OBJECT
+
+public:
+  ControlServer(NetSocket* sock);
+  bool listen();
+  QString execute(const QString& line);
+
+  NetSocket* sock;
+  QLocalServer* server;
+
+public slots:
+  void newConnection();
+  void readCommands();
+};
+
+#endif // PEERSTER_DAEMON_HH
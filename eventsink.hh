@@ -0,0 +1,113 @@
+#ifndef PEERSTER_EVENTSINK_HH
+#define PEERSTER_EVENTSINK_HH
+
+#include <QMetaObject>
+#include <QObject>
+#include <QString>
+
+// Everything the engine reports to whoever is driving it. The GUI receives
+// these through a QueuedSink; a headless node just logs. Calls are made on
+// the engine's thread.
+class EventSink {
+public:
+  virtual ~EventSink() {}
+
+  // A chat rumor from someone else was accepted.
+  virtual void chatMessageReceived(const QString& text,
+                                   const QString& origin) = 0;
+  // First rumor ever seen from this origin.
+  virtual void originDiscovered(const QString& origin) = 0;
+
+  // A private message or key exchange arrived from 'origin'.
+  virtual void privateChannelOpened(const QString& origin) = 0;
+  virtual void privateMessageReceived(const QString& origin,
+                                      const QString& text) = 0;
+
+  virtual void searchStarted(const QString& query) = 0;
+  // 'score' is the Credence score, or -2 if there isn't enough vote data.
+  virtual void searchResultFound(const QString& fileName, double score) = 0;
+
+  // Sent as a shared file is hashed; it's shared once 'bytesHashed' reaches
+  // 'bytesTotal'.
+  virtual void sharingProgress(const QString& fileName, qint64 bytesHashed,
+                               qint64 bytesTotal) = 0;
+  virtual void downloadStarted(const QString& fileName) = 0;
+  // Sent whenever another whole percent of the blocks is in.
+  virtual void downloadProgress(const QString& fileName, int blocksDone,
+                                int blocksTotal) = 0;
+  // The file turned out not to be what its metafile hash promised, or it
+  // couldn't be written.
+  virtual void downloadFailed(const QString& fileName) = 0;
+  virtual void downloadFinished(const QString& fileName,
+                                const QString& uploader) = 0;
+
+  // All barrier-to-entry files are in; the node may now be used.
+  virtual void nodeUnlocked() = 0;
+};
+
+// Forwards every event to the slot of the same name on 'target' through a
+// queued call, so a sink living on another thread (the GUI) never runs
+// engine code or gets called from the engine thread.
+class QueuedSink : public EventSink {
+public:
+  QueuedSink(QObject* target) {
+    this->target = target;
+  }
+
+  void chatMessageReceived(const QString& text, const QString& origin) {
+    QMetaObject::invokeMethod(target, "chatMessageReceived",
+        Qt::QueuedConnection, Q_ARG(QString, text), Q_ARG(QString, origin));
+  }
+  void originDiscovered(const QString& origin) {
+    QMetaObject::invokeMethod(target, "originDiscovered",
+        Qt::QueuedConnection, Q_ARG(QString, origin));
+  }
+  void privateChannelOpened(const QString& origin) {
+    QMetaObject::invokeMethod(target, "privateChannelOpened",
+        Qt::QueuedConnection, Q_ARG(QString, origin));
+  }
+  void privateMessageReceived(const QString& origin, const QString& text) {
+    QMetaObject::invokeMethod(target, "privateMessageReceived",
+        Qt::QueuedConnection, Q_ARG(QString, origin), Q_ARG(QString, text));
+  }
+  void searchStarted(const QString& query) {
+    QMetaObject::invokeMethod(target, "searchStarted",
+        Qt::QueuedConnection, Q_ARG(QString, query));
+  }
+  void searchResultFound(const QString& fileName, double score) {
+    QMetaObject::invokeMethod(target, "searchResultFound",
+        Qt::QueuedConnection, Q_ARG(QString, fileName), Q_ARG(double, score));
+  }
+  void downloadStarted(const QString& fileName) {
+    QMetaObject::invokeMethod(target, "downloadStarted",
+        Qt::QueuedConnection, Q_ARG(QString, fileName));
+  }
+  void sharingProgress(const QString& fileName, qint64 bytesHashed,
+                       qint64 bytesTotal) {
+    QMetaObject::invokeMethod(target, "sharingProgress",
+        Qt::QueuedConnection, Q_ARG(QString, fileName),
+        Q_ARG(qint64, bytesHashed), Q_ARG(qint64, bytesTotal));
+  }
+  void downloadProgress(const QString& fileName, int blocksDone,
+                        int blocksTotal) {
+    QMetaObject::invokeMethod(target, "downloadProgress",
+        Qt::QueuedConnection, Q_ARG(QString, fileName),
+        Q_ARG(int, blocksDone), Q_ARG(int, blocksTotal));
+  }
+  void downloadFailed(const QString& fileName) {
+    QMetaObject::invokeMethod(target, "downloadFailed",
+        Qt::QueuedConnection, Q_ARG(QString, fileName));
+  }
+  void downloadFinished(const QString& fileName, const QString& uploader) {
+    QMetaObject::invokeMethod(target, "downloadFinished",
+        Qt::QueuedConnection, Q_ARG(QString, fileName),
+        Q_ARG(QString, uploader));
+  }
+  void nodeUnlocked() {
+    QMetaObject::invokeMethod(target, "nodeUnlocked", Qt::QueuedConnection);
+  }
+
+  QObject* target;
+};
+
+#endif // PEERSTER_EVENTSINK_HH
@@ -0,0 +1,93 @@
+#include <QMutexLocker>
+
+#include "filestore.hh"
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+StoredFile::StoredFile(const QString& fileName) : file(fileName) {
+  size = 0;
+  if (!file.open(QIODevice::ReadOnly)) {
+    return;
+  }
+  size = file.size();
+}
+
+StoredFile::~StoredFile() {
+  file.close();
+}
+
+bool StoredFile::isOpen() const {
+  return file.isOpen();
+}
+
+QByteArray StoredFile::block(int index) {
+  qint64 offset = (qint64) index * FILESTORE_BLOCK_SIZE;
+  if (index < 0 || offset >= size) {
+    return QByteArray();
+  }
+  int length = (int) qMin((qint64) FILESTORE_BLOCK_SIZE, size - offset);
+  QByteArray data(length, Qt::Uninitialized);
+#ifdef Q_OS_UNIX
+  ssize_t n = pread(file.handle(), data.data(), length, offset);
+  data.resize(n < 0 ? 0 : (int) n);
+#else
+  QMutexLocker locker(&readLock);
+  file.seek(offset);
+  qint64 n = file.read(data.data(), length);
+  data.resize(n < 0 ? 0 : (int) n);
+#endif
+  return data;
+}
+
+FileStore::FileStore(int maxOpen) {
+  this->maxOpen = maxOpen;
+  hits = 0;
+  misses = 0;
+  evictions = 0;
+}
+
+bool FileStore::readBlock(const QString& fileName, int index,
+                          FileBlock* block) {
+  QSharedPointer<StoredFile> file = open(fileName);
+  if (file.isNull()) {
+    return false;
+  }
+  // Reading happens outside the store's lock; other workers may be paging
+  // in other blocks meanwhile.
+  block->file = file;
+  block->data = file->block(index);
+  return true;
+}
+
+void FileStore::close(const QString& fileName) {
+  QMutexLocker locker(&lock);
+  files.remove(fileName);
+  recent.removeOne(fileName);
+}
+
+QSharedPointer<StoredFile> FileStore::open(const QString& fileName) {
+  QMutexLocker locker(&lock);
+  QHash< QString, QSharedPointer<StoredFile> >::iterator it =
+      files.find(fileName);
+  if (it != files.end()) {
+    hits++;
+    recent.removeOne(fileName);
+    recent.append(fileName);
+    return it.value();
+  }
+
+  misses++;
+  QSharedPointer<StoredFile> file(new StoredFile(fileName));
+  if (!file->isOpen()) {
+    return QSharedPointer<StoredFile>();
+  }
+  while (files.size() >= maxOpen && !recent.isEmpty()) {
+    files.remove(recent.takeFirst());
+    evictions++;
+  }
+  files.insert(fileName, file);
+  recent.append(fileName);
+  return file;
+}
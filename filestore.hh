@@ -0,0 +1,76 @@
+#ifndef PEERSTER_FILESTORE_HH
+#define PEERSTER_FILESTORE_HH
+
+#include <atomic>
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+
+// Shared files kept open at once. Past this the least recently used one is
+// closed.
+#define FILESTORE_MAX_OPEN 64
+
+#define FILESTORE_BLOCK_SIZE 8192
+
+// A shared file, opened once. Blocks are read at their offset with pread(),
+// so workers don't share a file position. The file isn't mapped: the user
+// may truncate a shared file at any time, and touching a mapping past its
+// end raises SIGBUS, where pread() just comes up short.
+class StoredFile {
+public:
+  StoredFile(const QString& fileName);
+  ~StoredFile();
+
+  bool isOpen() const;
+  // Block 'index', or an empty array past the end of the file.
+  QByteArray block(int index);
+
+  QFile file;
+  qint64 size;
+
+private:
+  // Serializes seek() and read() where there's no pread().
+  QMutex readLock;
+};
+
+// A block read from the store. Holding it keeps the file open, even if the
+// store closes it.
+class FileBlock {
+public:
+  QSharedPointer<StoredFile> file;
+  QByteArray data;
+};
+
+// The open shared files, at most 'maxOpen' of them. Workers read blocks from
+// it concurrently.
+class FileStore {
+public:
+  FileStore(int maxOpen = FILESTORE_MAX_OPEN);
+
+  // Returns false if the file can't be opened.
+  bool readBlock(const QString& fileName, int index, FileBlock* block);
+  // Forgets a file that's no longer shared or has changed. Blocks already
+  // read from it stay valid.
+  void close(const QString& fileName);
+
+  // Updated by workers, read by the engine's stats.
+  std::atomic<quint64> hits;
+  std::atomic<quint64> misses;
+  std::atomic<quint64> evictions;
+
+private:
+  QSharedPointer<StoredFile> open(const QString& fileName);
+
+  QMutex lock;
+  QHash< QString, QSharedPointer<StoredFile> > files;
+  // Least recently used first.
+  QList<QString> recent;
+  int maxOpen;
+};
+
+#endif // PEERSTER_FILESTORE_HH
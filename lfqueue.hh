@@ -0,0 +1,116 @@
+#ifndef PEERSTER_LFQUEUE_HH
+#define PEERSTER_LFQUEUE_HH
+
+#include <atomic>
+#include <cstddef>
+
+using namespace std;
+
+// Unbounded lock-free queues built from a linked list with a dummy head
+// node. push() and pop() never block; pop() returns false when the queue is
+// empty. Values are copied in and out, so T is usually a pointer.
+
+// Single producer, single consumer. The producer only touches 'tail' and
+// the consumer only touches 'head', so the one atomic link between nodes is
+// all the synchronization needed.
+template <class T>
+class SpscQueue {
+public:
+  SpscQueue() {
+    head = tail = new Node();
+  }
+
+  ~SpscQueue() {
+    while (head != NULL) {
+      Node* next = head->next.load(memory_order_relaxed);
+      delete head;
+      head = next;
+    }
+  }
+
+  void push(const T& value) {
+    Node* n = new Node();
+    n->value = value;
+    tail->next.store(n, memory_order_release);
+    tail = n;
+  }
+
+  bool pop(T* out) {
+    Node* next = head->next.load(memory_order_acquire);
+    if (next == NULL) {
+      return false;
+    }
+    *out = next->value;
+    delete head;
+    head = next;
+    return true;
+  }
+
+  // Only meaningful on the consumer side.
+  bool isEmpty() const {
+    return head->next.load(memory_order_acquire) == NULL;
+  }
+
+private:
+  class Node {
+  public:
+    Node() : next(NULL), value() {}
+    atomic<Node*> next;
+    T value;
+  };
+
+  Node* head;  // consumer side; the dummy node
+  Node* tail;  // producer side
+};
+
+// Multiple producers, single consumer (Vyukov's queue). Producers claim
+// their place with one atomic exchange on 'tail' and then link the previous
+// node to theirs. Between those two steps the consumer sees the queue as
+// empty past that point, which is fine: the item shows up on a later pop().
+template <class T>
+class MpscQueue {
+public:
+  MpscQueue() {
+    head = new Node();
+    tail.store(head);
+  }
+
+  ~MpscQueue() {
+    while (head != NULL) {
+      Node* next = head->next.load(memory_order_relaxed);
+      delete head;
+      head = next;
+    }
+  }
+
+  void push(const T& value) {
+    Node* n = new Node();
+    n->value = value;
+    Node* prev = tail.exchange(n, memory_order_acq_rel);
+    prev->next.store(n, memory_order_release);
+  }
+
+  bool pop(T* out) {
+    Node* next = head->next.load(memory_order_acquire);
+    if (next == NULL) {
+      return false;
+    }
+    *out = next->value;
+    delete head;
+    head = next;
+    return true;
+  }
+
+private:
+  class Node {
+  public:
+    Node() : next(NULL), value() {}
+    atomic<Node*> next;
+    T value;
+  };
+
+  Node* head;          // consumer side; the dummy node
+  atomic<Node*> tail;  // shared by producers
+};
+
+#endif // PEERSTER_LFQUEUE_HH
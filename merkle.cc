@@ -0,0 +1,50 @@
+#include "merkle.hh"
+#include "sha1.hh"
+
+// Roots are only ever a handful of levels tall; anything more is bogus.
+#define MERKLE_MAX_HEIGHT 8
+
+QList<MerklePage> MerkleTree::build(const QByteArray& blockHashes) {
+  QList<MerklePage> pages;
+  Sha1 sha1;
+  QByteArray level = blockHashes;
+  int height = 1;
+  while (level.size() > 20 * MERKLE_FANOUT) {
+    QByteArray parent;
+    for (int offset = 0; offset < level.size();
+         offset += 20 * MERKLE_FANOUT) {
+      MerklePage page;
+      page.data = level.mid(offset, 20 * MERKLE_FANOUT);
+      sha1.update(page.data);
+      page.hash = sha1.final();
+      parent.append(page.hash);
+      pages.append(page);
+    }
+    level = parent;
+    height++;
+  }
+
+  MerklePage root;
+  if (height > 1) {
+    root.data.append((char) height);
+  }
+  root.data.append(level);
+  sha1.update(root.data);
+  root.hash = sha1.final();
+  pages.append(root);
+  return pages;
+}
+
+int MerkleTree::parseRoot(const QByteArray& root, QByteArray* entries) {
+  if (root.size() % 20 == 0) {
+    *entries = root;
+    return 1;
+  }
+  int height = (unsigned char) root.at(0);
+  if (root.size() % 20 != 1 || height < 2 || height > MERKLE_MAX_HEIGHT
+      || root.size() - 1 > 20 * MERKLE_FANOUT) {
+    return 0;
+  }
+  *entries = root.mid(1);
+  return height;
+}
@@ -0,0 +1,35 @@
+#ifndef PEERSTER_MERKLE_HH
+#define PEERSTER_MERKLE_HH
+
+#include <QByteArray>
+#include <QList>
+
+// Hashes per index page: 8000 bytes, about the size of a block.
+#define MERKLE_FANOUT 400
+
+// One index page of a file and its SHA-1.
+class MerklePage {
+public:
+  QByteArray hash;
+  QByteArray data;
+};
+
+// Metafiles as a tree of index pages. A level 1 page lists the SHA-1s of up
+// to MERKLE_FANOUT consecutive blocks, a level 2 page the SHA-1s of up to
+// MERKLE_FANOUT level 1 pages, and so on up to a single root page. The
+// root's SHA-1 is what a file is known by. Every page is fetched and
+// checked against the hash its parent lists, like a block.
+//
+// A file of up to MERKLE_FANOUT blocks has just a level 1 root, which is
+// exactly the old flat metafile. Taller roots start with one byte holding
+// the tree's height, so they're told apart by their length (20n + 1).
+class MerkleTree {
+public:
+  // All the index pages over 'blockHashes' (20 bytes per block), root last.
+  static QList<MerklePage> build(const QByteArray& blockHashes);
+  // The height of the tree below 'root' (1 for a flat metafile), and the
+  // hashes it lists. Returns 0 if 'root' is malformed.
+  static int parseRoot(const QByteArray& root, QByteArray* entries);
+};
+
+#endif // PEERSTER_MERKLE_HH
@@ -0,0 +1,334 @@
+#include <QDebug>
+#include <QHash>
+#include <QPair>
+
+#include "codec.hh"
+#include "netio.hh"
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
+// Room for the SO_RXQ_OVFL drop counter in each message's control data.
+#define RECV_CONTROL_SIZE CMSG_SPACE(sizeof(quint32))
+#endif
+
+DatagramPool::DatagramPool(int count, int bufferSize)
+  : bufferSize(bufferSize), storage(count * bufferSize, Qt::Uninitialized) {
+}
+
+char* DatagramPool::buffer(int i) {
+  return storage.data() + i * bufferSize;
+}
+
+int DatagramPool::count() const {
+  return storage.size() / bufferSize;
+}
+
+BatchReceiver::BatchReceiver(QUdpSocket* socket)
+  : wakeups(0), datagrams(0), saturatedWakeups(0), maxPerWakeup(0),
+    kernelDrops(0), socket(socket), pool(RECV_BATCH_SIZE, RECV_BUFFER_SIZE),
+    bulk(false), msgs(NULL), iovecs(NULL), addrs(NULL), control(NULL) {
+#ifdef Q_OS_LINUX
+  int fd = socket->socketDescriptor();
+  if (fd < 0) {
+    return;
+  }
+
+  int one = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) != 0) {
+    qDebug() << "SO_RXQ_OVFL not available; kernel drops won't be counted.";
+  }
+
+  msgs = new struct mmsghdr[RECV_BATCH_SIZE];
+  iovecs = new struct iovec[RECV_BATCH_SIZE];
+  addrs = new struct sockaddr_storage[RECV_BATCH_SIZE];
+  control = new char[RECV_BATCH_SIZE * RECV_CONTROL_SIZE];
+  bulk = true;
+#endif
+}
+
+BatchReceiver::~BatchReceiver() {
+#ifdef Q_OS_LINUX
+  delete[] msgs;
+  delete[] iovecs;
+  delete[] addrs;
+  delete[] control;
+#endif
+}
+
+int BatchReceiver::receiveBatch(QVector<ReceivedDatagram>* batch) {
+  if (!bulk) {
+    return receiveFallback(batch);
+  }
+
+#ifdef Q_OS_LINUX
+  for (int i = 0; i < RECV_BATCH_SIZE; ++i) {
+    iovecs[i].iov_base = pool.buffer(i);
+    iovecs[i].iov_len = pool.bufferSize;
+    memset(&msgs[i], 0, sizeof(msgs[i]));
+    msgs[i].msg_hdr.msg_name = &addrs[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    msgs[i].msg_hdr.msg_iov = &iovecs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_control = control + i * RECV_CONTROL_SIZE;
+    msgs[i].msg_hdr.msg_controllen = RECV_CONTROL_SIZE;
+  }
+
+  int n = recvmmsg(socket->socketDescriptor(), msgs, RECV_BATCH_SIZE,
+                   MSG_DONTWAIT, NULL);
+  if (n < 0) {
+    if (errno == ENOSYS) {
+      // Old kernel: use the portable path from now on.
+      bulk = false;
+      return receiveFallback(batch);
+    }
+    return 0;
+  }
+
+  batch->resize(n);
+  for (int i = 0; i < n; ++i) {
+    ReceivedDatagram& d = (*batch)[i];
+    d.data = pool.buffer(i);
+    d.size = msgs[i].msg_len;
+    d.address = QHostAddress((const struct sockaddr*) &addrs[i]);
+    if (addrs[i].ss_family == AF_INET6) {
+      d.port = ntohs(((struct sockaddr_in6*) &addrs[i])->sin6_port);
+    } else {
+      d.port = ntohs(((struct sockaddr_in*) &addrs[i])->sin_port);
+    }
+
+    struct msghdr* hdr = &msgs[i].msg_hdr;
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(hdr); c != NULL;
+        c = CMSG_NXTHDR(hdr, c)) {
+      if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+        memcpy(&kernelDrops, CMSG_DATA(c), sizeof(kernelDrops));
+      }
+    }
+  }
+  return n;
+#else
+  return 0;
+#endif
+}
+
+int BatchReceiver::receiveFallback(QVector<ReceivedDatagram>* batch) {
+  int n = 0;
+  batch->resize(RECV_BATCH_SIZE);
+  while (n < RECV_BATCH_SIZE && socket->hasPendingDatagrams()) {
+    ReceivedDatagram& d = (*batch)[n];
+    d.data = pool.buffer(n);
+    d.size = socket->readDatagram(pool.buffer(n), pool.bufferSize,
+                                  &d.address, &d.port);
+    if (d.size < 0) {
+      break;
+    }
+    n++;
+  }
+  batch->resize(n);
+  return n;
+}
+
+int BatchReceiver::rearm(QVector<ReceivedDatagram>* batch) {
+  if (!bulk) {
+    // receiveFallback() already went through readDatagram().
+    batch->resize(0);
+    return 0;
+  }
+  batch->resize(1);
+  ReceivedDatagram& d = (*batch)[0];
+  d.data = pool.buffer(0);
+  d.size = socket->readDatagram(pool.buffer(0), pool.bufferSize,
+                                &d.address, &d.port);
+  if (d.size < 0) {
+    batch->resize(0);
+    return 0;
+  }
+  return 1;
+}
+
+void BatchReceiver::recordWakeup(int numDatagrams) {
+  wakeups++;
+  datagrams += numDatagrams;
+  if (numDatagrams > maxPerWakeup) {
+    maxPerWakeup = numDatagrams;
+  }
+  if (numDatagrams >= RECV_BATCH_SIZE * RECV_MAX_BATCHES) {
+    saturatedWakeups++;
+  }
+}
+
+SendQueue::SendQueue(QUdpSocket* socket)
+  : messages(0), datagrams(0), syscalls(0), bytes(0), sendErrors(0),
+    socket(socket), bulk(false), msgs(NULL), iovecs(NULL), addrs(NULL) {
+#ifdef Q_OS_LINUX
+  if (socket->socketDescriptor() >= 0) {
+    msgs = new struct mmsghdr[SEND_BATCH_SIZE];
+    iovecs = new struct iovec[SEND_BATCH_SIZE];
+    addrs = new struct sockaddr_storage[SEND_BATCH_SIZE];
+    bulk = true;
+  }
+#endif
+}
+
+SendQueue::~SendQueue() {
+#ifdef Q_OS_LINUX
+  delete[] msgs;
+  delete[] iovecs;
+  delete[] addrs;
+#endif
+}
+
+void SendQueue::enqueue(const QByteArray& datagram, bool coalescable,
+                        const QHostAddress& address, quint16 port) {
+  OutgoingDatagram d;
+  d.data = datagram;
+  d.address = address;
+  d.port = port;
+  d.coalescable = coalescable && datagram.size() <= COALESCE_MAX_MESSAGE
+      && address.protocol() == QAbstractSocket::IPv4Protocol;
+  pending.append(d);
+  messages++;
+}
+
+bool SendQueue::isEmpty() const {
+  return pending.isEmpty();
+}
+
+void SendQueue::coalesce(QList<OutgoingDatagram>* out) {
+  // For each destination, where its currently open bundle sits in 'out' and
+  // how many messages are in it.
+  QHash<quint64, QPair<int, int> > open;
+
+  for (const OutgoingDatagram& d : pending) {
+    if (!d.coalescable) {
+      out->append(d);
+      continue;
+    }
+
+    quint64 key = ((quint64) d.address.toIPv4Address() << 16) | d.port;
+    if (open.contains(key)) {
+      QPair<int, int>& slot = open[key];
+      OutgoingDatagram& target = (*out)[slot.first];
+      if (slot.second == 1) {
+        // Turn the lone message into a bundle holding it and this one.
+        QByteArray bundle;
+        if (WireCodec::appendToBundle(&bundle, target.data,
+                                      COALESCE_MAX_DATAGRAM)
+            && WireCodec::appendToBundle(&bundle, d.data,
+                                         COALESCE_MAX_DATAGRAM)) {
+          target.data = bundle;
+          slot.second = 2;
+          continue;
+        }
+      } else if (WireCodec::appendToBundle(&target.data, d.data,
+                                           COALESCE_MAX_DATAGRAM)) {
+        slot.second++;
+        continue;
+      }
+    }
+
+    // No open bundle for this peer, or it's full: start a new one.
+    out->append(d);
+    open.insert(key, qMakePair(out->size() - 1, 1));
+  }
+}
+
+int SendQueue::flush() {
+  if (pending.isEmpty()) {
+    return 0;
+  }
+
+  QList<OutgoingDatagram> out;
+  coalesce(&out);
+  pending.clear();
+
+  int i = 0;
+  while (i < out.size()) {
+    if (bulk && out.at(i).address.protocol() == QAbstractSocket::IPv4Protocol) {
+      // Gather a run of IPv4 datagrams for one sendmmsg() call.
+      int count = 0;
+      while (count < SEND_BATCH_SIZE && i + count < out.size()
+          && out.at(i + count).address.protocol()
+              == QAbstractSocket::IPv4Protocol) {
+        count++;
+      }
+      int sent = sendBulk(out, i, count);
+      if (sent <= 0) {
+        // Couldn't hand these to the kernel; drop them like a full socket
+        // buffer would.
+        sendErrors += count;
+        i += count;
+      } else {
+        i += sent;
+      }
+    } else {
+      sendSingle(out.at(i));
+      i++;
+    }
+  }
+  return out.size();
+}
+
+int SendQueue::sendBulk(const QList<OutgoingDatagram>& list, int start,
+                        int count) {
+#ifdef Q_OS_LINUX
+  for (int i = 0; i < count; ++i) {
+    const OutgoingDatagram& d = list.at(start + i);
+    struct sockaddr_in* sin = (struct sockaddr_in*) &addrs[i];
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(d.port);
+    sin->sin_addr.s_addr = htonl(d.address.toIPv4Address());
+
+    iovecs[i].iov_base = (void*) d.data.constData();
+    iovecs[i].iov_len = d.data.size();
+    memset(&msgs[i], 0, sizeof(msgs[i]));
+    msgs[i].msg_hdr.msg_name = sin;
+    msgs[i].msg_hdr.msg_namelen = sizeof(*sin);
+    msgs[i].msg_hdr.msg_iov = &iovecs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  syscalls++;
+  int n = sendmmsg(socket->socketDescriptor(), msgs, count, MSG_DONTWAIT);
+  if (n < 0) {
+    if (errno == ENOSYS) {
+      bulk = false;
+      for (int i = 0; i < count; ++i) {
+        sendSingle(list.at(start + i));
+      }
+      return count;
+    }
+    return n;
+  }
+  for (int i = 0; i < n; ++i) {
+    datagrams++;
+    bytes += list.at(start + i).data.size();
+  }
+  return n;
+#else
+  Q_UNUSED(list);
+  Q_UNUSED(start);
+  Q_UNUSED(count);
+  return -1;
+#endif
+}
+
+void SendQueue::sendSingle(const OutgoingDatagram& d) {
+  syscalls++;
+  if (socket->writeDatagram(d.data, d.address, d.port) < 0) {
+    sendErrors++;
+    return;
+  }
+  datagrams++;
+  bytes += d.data.size();
+}
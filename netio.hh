@@ -0,0 +1,137 @@
+#ifndef PEERSTER_NETIO_HH
+#define PEERSTER_NETIO_HH
+
+#include <QByteArray>
+#include <QHostAddress>
+#include <QList>
+#include <QUdpSocket>
+#include <QVector>
+
+// Datagrams pulled off the socket per receive call.
+#define RECV_BATCH_SIZE 32
+// Receive calls per wakeup before we yield back to the event loop. The read
+// notifier is level-triggered, so whatever is left wakes us up again.
+#define RECV_MAX_BATCHES 8
+// Largest possible UDP payload, rounded up.
+#define RECV_BUFFER_SIZE 65536
+
+// Messages no bigger than this may share a datagram with other small
+// messages bound for the same peer.
+#define COALESCE_MAX_MESSAGE 512
+// Coalesced datagrams stay under a typical Ethernet MTU.
+#define COALESCE_MAX_DATAGRAM 1400
+// Datagrams handed to the kernel per sendmmsg() call.
+#define SEND_BATCH_SIZE 64
+
+struct iovec;
+struct mmsghdr;
+struct sockaddr_storage;
+
+// A datagram sitting in one of the pool's buffers. 'data' is only valid
+// until the next receiveBatch() call.
+class ReceivedDatagram {
+public:
+  const char* data;
+  int size;
+  QHostAddress address;
+  quint16 port;
+};
+
+// Fixed set of receive buffers, allocated once and reused for every batch,
+// so the receive path doesn't allocate per packet.
+class DatagramPool {
+public:
+  DatagramPool(int count, int bufferSize);
+
+  char* buffer(int i);
+  int count() const;
+
+  int bufferSize;
+
+private:
+  QByteArray storage;
+};
+
+// Drains a UDP socket in batches. On Linux this is one recvmmsg() call per
+// batch, and SO_RXQ_OVFL reports how many datagrams the kernel dropped
+// because the socket buffer was full. Elsewhere it falls back to a
+// readDatagram() loop.
+class BatchReceiver {
+public:
+  BatchReceiver(QUdpSocket* socket);
+  ~BatchReceiver();
+
+  // Reads up to RECV_BATCH_SIZE pending datagrams into 'batch' and returns
+  // how many were read.
+  int receiveBatch(QVector<ReceivedDatagram>* batch);
+  // Call at the end of every readyRead(). QUdpSocket turns its read
+  // notifier off before emitting readyRead() and only turns it back on in
+  // readDatagram(), which recvmmsg() bypasses; so this makes one
+  // readDatagram() call. It usually finds nothing, but any datagram it
+  // does read is put in 'batch', and the count returned.
+  int rearm(QVector<ReceivedDatagram>* batch);
+  void recordWakeup(int numDatagrams);
+
+  quint64 wakeups;
+  quint64 datagrams;
+  quint64 saturatedWakeups;  // wakeups that hit RECV_MAX_BATCHES
+  int maxPerWakeup;
+  quint32 kernelDrops;       // cumulative, as reported by SO_RXQ_OVFL
+
+private:
+  int receiveFallback(QVector<ReceivedDatagram>* batch);
+
+  QUdpSocket* socket;
+  DatagramPool pool;
+  bool bulk;
+  struct mmsghdr* msgs;
+  struct iovec* iovecs;
+  struct sockaddr_storage* addrs;
+  char* control;
+};
+
+class OutgoingDatagram {
+public:
+  QByteArray data;
+  QHostAddress address;
+  quint16 port;
+  bool coalescable;
+};
+
+// Collects outgoing datagrams during one event-loop turn and flushes them
+// together. Small control messages for the same peer are packed into one
+// bundle datagram, and on Linux the whole queue goes out through sendmmsg()
+// in SEND_BATCH_SIZE chunks.
+class SendQueue {
+public:
+  SendQueue(QUdpSocket* socket);
+  ~SendQueue();
+
+  void enqueue(const QByteArray& datagram, bool coalescable,
+               const QHostAddress& address, quint16 port);
+  bool isEmpty() const;
+
+  // Sends everything queued so far and returns the number of datagrams
+  // that went out.
+  int flush();
+
+  quint64 messages;
+  quint64 datagrams;
+  quint64 syscalls;
+  quint64 bytes;
+  quint64 sendErrors;
+
+private:
+  void coalesce(QList<OutgoingDatagram>* out);
+  int sendBulk(const QList<OutgoingDatagram>& list, int start, int count);
+  void sendSingle(const OutgoingDatagram& d);
+
+  QUdpSocket* socket;
+  QList<OutgoingDatagram> pending;
+  bool bulk;
+  struct mmsghdr* msgs;
+  struct iovec* iovecs;
+  struct sockaddr_storage* addrs;
+};
+
+#endif // PEERSTER_NETIO_HH
@@ -0,0 +1,1762 @@
+#include <cmath>
+#include <unistd.h>
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegExp>
+#include <QThreadPool>
+#include <QTime>
+#include <QTimer>
+
+#include "crypto.hh"
+#include "netsocket.hh"
+#include "sha1.hh"
+#include "workers.hh"
+
+QString generateBTEFileName(int n) {
+  return BTE_PREFIX + QString::number(n) + BTE_SUFFIX + BTE_EXTENSION;
+}
+
+// make sure this matches ALL filenames generated by generateBTEFileName(...)
+QString generateBTERegexString() {
+  return BTE_PREFIX + QString("\\d+") + BTE_SUFFIX + BTE_EXTENSION;
+}
+
+QByteArray NetSocket::getMetafileHashes(QVariantList fileMatches) {
+  QByteArray ret = QByteArray();
+  for (int i = 0; i < fileMatches.size(); ++i) {
+    QString fileName = fileMatches.at(i).toString();
+    if (fileMap->count(fileName) == 0) {
+      qDebug() << "File map did not contain file name, was expected to.";
+    }
+    ret.append(fileMap->at(fileName).hash);
+  }
+  return ret;
+}
+
+// Directories are shared with everything under them. Files are hashed a
+// chunk at a time on the workers, and each shows up in the file map once all
+// of it is done.
+void NetSocket::addFile(QString fileName) {
+  QFileInfo info(fileName);
+  if (info.isDir()) {
+    startJob(new WalkDirectoryJob(this, fileName));
+    return;
+  }
+  if (!info.isReadable()) {
+    qDebug() << "Can't read" << fileName;
+    return;
+  }
+  if (indexing.contains(fileName)) {
+    qDebug() << "Already hashing" << fileName;
+    return;
+  }
+
+  PendingFile* file = new PendingFile(fileName, info.size());
+  indexing.insert(fileName, file);
+  if (file->numChunks == 0) {
+    finishIndexing(file);
+    return;
+  }
+  for (int i = 0; i < file->numChunks; ++i) {
+    startJob(new HashChunkJob(this, file, i));
+  }
+}
+
+void NetSocket::chunkHashed(PendingFile* file, qint64 bytes) {
+  file->chunksFinished++;
+  file->bytesHashed += bytes;
+  if (file->chunksFinished == file->numChunks) {
+    finishIndexing(file);
+    return;
+  }
+  int percent = (int) (100 * file->bytesHashed / file->numBytes);
+  if (percent != file->reportedPercent) {
+    file->reportedPercent = percent;
+    sink->sharingProgress(file->fileName, file->bytesHashed, file->numBytes);
+  }
+}
+
+// Publishes a completely hashed file. Sharing a file again replaces what we
+// had for it.
+void NetSocket::finishIndexing(PendingFile* file) {
+  indexing.remove(file->fileName);
+  if (file->failed) {
+    qDebug() << file->fileName << "changed while being hashed; not shared";
+    delete file;
+    return;
+  }
+
+  if (fileMap->count(file->fileName) != 0) {
+    removeFile(file->fileName);
+  }
+  fileStore->close(file->fileName);
+
+  FileData fd;
+  fd.numBytes = file->numBytes;
+  fd.metafile = file->metafile;
+  fd.pages = file->pages;
+  fd.hash = file->pages.last().hash;
+  fileMap->insert(make_pair(file->fileName, fd));
+  blockIndex->addFile(file->fileName, fd.pages, fd.metafile);
+  searchIndex->addFile(file->fileName);
+  sink->sharingProgress(file->fileName, file->numBytes, file->numBytes);
+  delete file;
+}
+
+// Stops sharing 'fileName'. Files we downloaded stay on disk.
+void NetSocket::removeFile(QString fileName) {
+  FileMap::iterator it = fileMap->find(fileName);
+  if (it == fileMap->end()) {
+    qDebug() << "Not sharing" << fileName;
+    return;
+  }
+  blockIndex->removeFile(fileName, it->second.pages, it->second.metafile);
+  searchIndex->removeFile(fileName);
+  fileMap->erase(it);
+  fileStore->close(fileName);
+}
+
+// Finds what 'blockHash' refers to. An index page is returned directly; a
+// file block is returned as its file name and block index, since reading it
+// is left to a worker.
+QByteArray NetSocket::findBlock(QByteArray blockHash, QString* fileName,
+                                int* index) {
+  QByteArray page;
+  if (blockIndex->findPage(blockHash, &page)) {
+    return page;
+  }
+  BlockLocation location;
+  if (blockIndex->findBlock(blockHash, &location)) {
+    *fileName = location.fileName;
+    *index = location.index;
+  }
+  return QByteArray();
+}
+
+void NetSocket::addMsg(QVariantMap* map) {
+  QString orig = map->value(*originKey).toString();
+  QString text;
+  if(map->contains(*chatTextKey)) {
+    text = map->value(*chatTextKey).toString();
+  } else {
+    text = QString::null;
+  }
+  rumors->append(orig, text);
+  myWant.insert(orig, rumors->count(orig) + 1);
+  statusDatagram.clear();
+}
+
+NetSocket::NetSocket() {
+  // Initialize constants
+  blockReplyKey = new QString("BlockReply");
+  blockRequestKey = new QString("BlockRequest");
+  budgetKey = new QString("Budget");
+  chatTextKey = new QString("ChatText");
+  cryptoKey = new QString("Crypto");
+  dataKey = new QString("Data");
+  destKey = new QString("Dest");
+  digestKey = new QString("Digest");
+  hopLimitKey = new QString("HopLimit");
+  hopsKey = new QString("Hops");
+  matchIDsKey = new QString("MatchIDs");
+  matchNamesKey = new QString("MatchNames");
+  originKey = new QString("Origin");
+  originsKey = new QString("Origins");
+  probeKey = new QString("Probe");
+  searchReplyKey = new QString("SearchReply");
+  searchRequestKey = new QString("Search");
+  seqNoKey = new QString("SeqNo");
+  wantKey = new QString("Want");
+  lastIPKey = new QString("LastIP");
+  lastPortKey = new QString("LastPort");
+
+  // if tagKey = 1, then that means I'm sending a routing table and I want a
+  // response routing table.  If tagKey = 2, that means I'm sending a routing
+  // table but don't want one in reply.
+  tagKey = new QString("Tag");
+  vhKey = new QString("vhKey");
+  routes = new RouteTable();
+  forwarding = true;
+  searching = false;
+  hostLookups = new HNLookupList();
+  peerTable = new PeerTable();
+  transfers = new TransferManager();
+  maxWindow = WINDOW_DEFAULT_MAX;
+  clock.start();
+  resultMap = new ResultMap();
+  resultSources = new ResultSources();
+  votingHistory = new VotingHistory();
+  downloadedFiles = new QSet<QString>();
+  unlocked = false;
+  sink = NULL;
+
+  // Node identity and local state.
+  rumors = new RumorStore();
+  statusesSent = 0;
+  statusesEncoded = 0;
+  digestsSent = 0;
+  digestsMatched = 0;
+  probesSent = 0;
+  fileMap = new FileMap();
+  blockIndex = new BlockIndex();
+  searchIndex = new SearchIndex();
+  fileStore = new FileStore();
+  myOriginID = new QString("aefijaw");
+  qsrand(QTime::currentTime().msec());
+  myOriginID->append(QString::number(qrand()));
+
+  // Generate cryptographic keys for RSA
+  vector<string> key_vec = gen_keys();
+  n =        key_vec[0];
+  pub_key =  key_vec[1];
+  priv_key = key_vec[2];
+
+  qDebug() << "New Public Key: " << pub_key.c_str();
+  qDebug() << "New Private Key: " << priv_key.c_str();
+  qDebug() << "N = p * q: " << n.c_str();
+
+  cryptoKeys = new QHash<QString, QPair<QString, QString> >();
+
+  // Pick a range of four UDP ports to try to allocate by default, computed
+  // based on my Unix user ID. This makes it trivial for up to four Peerster
+  // instances per user to find each other on the same host, barring UDP port
+  // conflicts with other applications (which are quite possible).
+  // We use the range from 32768 to 49151 for this purpose.
+  myPortMin = 32768 + (getuid() % 4096) * 4;
+  myPortMax = myPortMin + 3;
+
+  // Anti Entropy
+  QTimer *aeTimer = new QTimer(this);
+  connect(aeTimer, SIGNAL(timeout()), this, SLOT(antiEntropy()));
+  aeTimer->start(10000);
+
+  // Failure detection
+  QTimer *probeTimer = new QTimer(this);
+  connect(probeTimer, SIGNAL(timeout()), this, SLOT(probePeers()));
+  probeTimer->start(PEER_PROBE_MS);
+
+  // Rumor queue, and timeouts for rumors waiting on a status
+  rumorQueue = new RumorQueue();
+  rumorTimer = new QTimer(this);
+  connect(rumorTimer, SIGNAL(timeout()), this, SLOT(checkRumors()));
+
+  // Per-block request timeouts
+  transferTimer = new QTimer(this);
+  connect(transferTimer, SIGNAL(timeout()), this, SLOT(checkTransfers()));
+
+  // Route rumor: right after the topology changes, then less and less
+  // often while it doesn't.
+  routeTrickle = new TrickleTimer(ROUTE_RUMOR_MIN_MS, ROUTE_RUMOR_MAX_MS,
+                                  clock.elapsed());
+  peerChanges = 0;
+  routeTimer = new QTimer(this);
+  routeTimer->setSingleShot(true);
+  connect(routeTimer, SIGNAL(timeout()), this, SLOT(routeRumorDue()));
+  scheduleRouteRumor();
+  controlSent = 0;
+  controlBytes = 0;
+  reportedControlSent = 0;
+  reportedControlBytes = 0;
+  reportedAt = 0;
+
+  // Message dispatch table: one handler per wire tag.
+  for (int t = 0; t < TAG_COUNT; ++t) {
+    dispatchTable[t].handler = NULL;
+    dispatchTable[t].count = 0;
+    dispatchTable[t].totalNs = 0;
+    dispatchTable[t].maxNs = 0;
+  }
+  malformedDatagrams = 0;
+  registerHandler(TAG_PRIV_RUMOR, &NetSocket::dispatchForwardable);
+  registerHandler(TAG_CRYPTO, &NetSocket::dispatchForwardable);
+  registerHandler(TAG_BLOCK_REQUEST, &NetSocket::dispatchForwardable);
+  registerHandler(TAG_BLOCK_REPLY, &NetSocket::dispatchForwardable);
+  registerHandler(TAG_SEARCH_REPLY, &NetSocket::dispatchForwardable);
+  registerHandler(TAG_SEARCH_REQUEST, &NetSocket::dispatchSearchRequest);
+  registerHandler(TAG_RUMOR, &NetSocket::dispatchRumor);
+  registerHandler(TAG_ROUTE_RUMOR, &NetSocket::dispatchRumor);
+  registerHandler(TAG_VOTE_HISTORY, &NetSocket::dispatchVoteHistory);
+  registerHandler(TAG_STATUS, &NetSocket::dispatchStatus);
+  registerHandler(TAG_STATUS_DIGEST, &NetSocket::dispatchStatusDigest);
+
+  // Periodically dump per-handler counters.
+  QTimer *statsTimer = new QTimer(this);
+  connect(statsTimer, SIGNAL(timeout()), this, SLOT(logStats()));
+  statsTimer->start(60000);
+
+  // The receive and send paths are hooked up in bind(), once there is a
+  // socket.
+  receiver = NULL;
+  sendQueue = NULL;
+  flushScheduled = false;
+
+  // Hashing, block reads and RSA run on a pool so they don't hold up the
+  // socket.
+  workers = new QThreadPool(this);
+  jobsStarted = 0;
+  jobsFinished = 0;
+  finishScheduled = false;
+}
+
+void NetSocket::startJob(EngineJob* job) {
+  jobsStarted++;
+  workers->start(job);
+}
+
+// Called on a pool thread. One queued call drains everything that finished
+// in the meantime.
+void NetSocket::completeJob(EngineJob* job) {
+  completedJobs.push(job);
+  if (!finishScheduled.exchange(true)) {
+    QMetaObject::invokeMethod(this, "finishJobs", Qt::QueuedConnection);
+  }
+}
+
+void NetSocket::finishJobs() {
+  finishScheduled = false;
+  EngineJob* job;
+  while (completedJobs.pop(&job)) {
+    job->finish();
+    delete job;
+    jobsFinished++;
+  }
+}
+
+void NetSocket::sendDownloadRequest(QString fileName) {
+  if (resultMap->count(fileName) == 0) {
+    qDebug() << "No search result for" << fileName;
+    return;
+  }
+  ResultData resultData = resultMap->at(fileName);
+  if (transfers->find(resultData.hash) != NULL) {
+    qDebug() << "Already downloading" << fileName;
+    return;
+  }
+  sink->downloadStarted(fileName);
+
+  Transfer* t = new Transfer(fileName, resultData.uploaderDest,
+                             resultData.hash, maxWindow);
+  QStringList sources = resultSources->value(resultData.hash);
+  for (const QString& origin : sources) {
+    t->addSource(origin);
+  }
+  t->startedAt = clock.elapsed();
+  transfers->add(t);
+  if (!t->open()) {
+    failTransfer(t);
+    return;
+  }
+  t->save(t->startedAt);
+  pumpTransfer(t);
+  if (!transferTimer->isActive()) {
+    transferTimer->start(TRANSFER_TICK_MS);
+  }
+}
+
+void NetSocket::resumeTransfers() {
+  QStringList states = QDir(".").entryList(QStringList("*.part.state"),
+                                           QDir::Files);
+  for (const QString& statePath : states) {
+    Transfer* t = Transfer::load(statePath, maxWindow);
+    if (t == NULL || transfers->find(t->metafileHash) != NULL) {
+      qDebug() << "Can't resume download from" << statePath;
+      delete t;
+      continue;
+    }
+    qDebug() << "Resuming download of" << t->fileName << "from"
+             << t->window->sources.size() << "sources";
+    sink->downloadStarted(t->fileName);
+    t->startedAt = clock.elapsed();
+    transfers->add(t);
+    if (!t->open()) {
+      failTransfer(t);
+      continue;
+    }
+    pumpTransfer(t);
+  }
+  if (!transfers->isEmpty() && !transferTimer->isActive()) {
+    transferTimer->start(TRANSFER_TICK_MS);
+  }
+}
+
+void NetSocket::saveTransfers() {
+  qint64 now = clock.elapsed();
+  for (Transfer* t : transfers->all()) {
+    if (t->dirty && !t->save(now)) {
+      qDebug() << "Can't save download state of" << t->fileName;
+    }
+  }
+}
+
+// Sends requests for as many blocks as the sources' windows allow.
+void NetSocket::pumpTransfer(Transfer* t) {
+  QList<BlockRequest> requests = t->window->nextRequests(clock.elapsed());
+  for (const BlockRequest& r : requests) {
+    QByteArray hash = t->itemHash(r.index);
+    if (hash.isEmpty()) {
+      // The hash is dropped once the block is in; a request without one
+      // could never be answered.
+      qDebug() << "Error. no hash for block" << r.index << "of" << t->fileName;
+      continue;
+    }
+    sendBlockRequest(&r.origin, *myOriginID, (quint32) 10, hash);
+  }
+}
+
+void NetSocket::checkTransfers() {
+  if (transfers->isEmpty()) {
+    transferTimer->stop();
+    return;
+  }
+  qint64 now = clock.elapsed();
+  QList<Transfer*> list = transfers->all();
+  for (Transfer* t : list) {
+    if (t->window->expire(now) > 0) {
+      pumpTransfer(t);
+    }
+    if (t->dirty && now - t->savedAt >= TRANSFER_SAVE_MS) {
+      t->save(now);
+    }
+  }
+}
+
+void NetSocket::finishTransfer(Transfer* t) {
+  BlockWindow* w = t->window;
+  qDebug() << "download" << t->fileName
+           << "blocks:" << t->numBlocks
+           << "index pages:" << (w->numBlocks - t->numBlocks)
+           << "ms:" << (clock.elapsed() - t->startedAt)
+           << "sources:" << w->sources.size()
+           << "retransmits:" << w->retransmits;
+  for (SourceWindow* s : w->sources) {
+    qDebug() << "  source" << s->origin
+             << "blocks:" << s->received
+             << "window:" << s->cwnd
+             << "srtt ms:" << s->srtt
+             << "timeouts:" << s->timeouts;
+  }
+
+  if (!t->commit()) {
+    failTransfer(t);
+    return;
+  }
+  downloadedFiles->insert(t->fileName);
+
+  if (!unlocked) {
+    addFile(t->fileName);
+  }
+  QString fileName = t->fileName;
+  QString uploader = t->uploader;
+  transfers->remove(t);
+  delete t;
+  sink->downloadFinished(fileName, uploader);
+}
+
+void NetSocket::failTransfer(Transfer* t) {
+  qDebug() << "download" << t->fileName << "failed:" << t->error;
+  QString fileName = t->fileName;
+  transfers->remove(t);
+  t->discard();
+  delete t;
+  sink->downloadFailed(fileName);
+}
+
+void NetSocket::sendChatMessage(QString text) {
+  const QString trimmedText = text.trimmed().replace("\n", "");
+  QVariantMap* map = makeMyRumorMap(&trimmedText, new QString(), false);
+  incomingRQ.push(map);
+  handleIncomingRQ();
+}
+
+// Send my public key to 'origin' so it can send me private messages.
+void NetSocket::sendCryptoKeys(QString origin) {
+  if (!routes->contains(origin)) {
+    qDebug() << "No route to" << origin;
+    return;
+  }
+  const QString blank = QString("");
+  QVariantMap *crypto_map = makeMyRumorMap(&blank, &origin, true);
+  crypto_map->insert("N", QString(n.c_str()));
+  crypto_map->insert("PublicKey", QString(pub_key.c_str()));
+  crypto_map->insert(QString("Crypto"), "Crypto");
+  sendRouted(crypto_map, origin);
+}
+
+// Returns false if we don't have a route or key for 'origin' yet.
+bool NetSocket::sendPrivateMessage(QString origin, QString text) {
+  if (!routes->contains(origin) || !cryptoKeys->contains(origin)) {
+    qDebug() << "No route or key for" << origin << "yet.";
+    return false;
+  }
+  startJob(new EncryptJob(this, origin, text.trimmed().replace("\n", "")));
+  return true;
+}
+
+// Sends an already encrypted private message.
+void NetSocket::sendPrivateRumor(QString origin, QString cipherText) {
+  QVariantMap* map = makeMyRumorMap(&cipherText, &origin, true);
+  sendRouted(map, origin);
+}
+
+// Unlocks the node once every barrier-to-entry file has been downloaded.
+bool NetSocket::tryUnlock() {
+  for (int i = 0; i < BTE_COUNT; i++) {
+    QString fileName = generateBTEFileName(i);
+    if (!downloadedFiles->contains(fileName)) {
+      qDebug() << "Not all files have been downloaded!";
+      return false;
+    }
+  }
+  unlocked = true;
+  qDebug() << "Good job!  You have unlocked Peerster :)";
+  sink->nodeUnlocked();
+  return true;
+}
+
+void NetSocket::routeRumorDue() {
+  routeRumor();
+  routeTrickle->fired();
+  scheduleRouteRumor();
+}
+
+void NetSocket::scheduleRouteRumor() {
+  routeTimer->start(qMax((qint64) 0, routeTrickle->due() - clock.elapsed()));
+}
+
+// Peers coming and going change how others reach us, so our route rumor
+// goes out again soon.
+void NetSocket::checkTopology() {
+  if (peerTable->changes == peerChanges) {
+    return;
+  }
+  peerChanges = peerTable->changes;
+  if (routeTrickle->reset(clock.elapsed())) {
+    scheduleRouteRumor();
+  }
+}
+
+void NetSocket::routeRumor() {
+  quint32 seqno = rumors->count(*myOriginID) + 1;
+
+  QVariantMap* map = new QVariantMap();
+  map->insert(*originKey, *myOriginID);
+  map->insert(*seqNoKey, seqno);
+  incomingRQ.push(map);
+  handleIncomingRQ();
+}
+
+// Remember, "async" defaults to true
+void NetSocket::addPeer(QString arg, bool async) {
+  int i = arg.indexOf(':');
+  if (i <= 0 || i == arg.size() - 1) {
+    qDebug() << "Specified peer needs form host:port";
+    return;
+  }
+
+  QStringList list = arg.split(':');
+  QString host = list.at(0);
+  QString portStr = list.at(1);
+  if (portStr.indexOf(':') != -1) {
+    qDebug() << "Two colons detected in specified peer.  Needs form host:port.";
+    return;
+  }
+
+  quint16 port = portStr.toUShort();
+  
+  QHostAddress address;
+  // Try to parse 'host' as an IP address. If this doesn't work, then treat
+  // 'host' as a hostname and look up its corresponding IP.
+  if (!address.setAddress(host)) {
+    if (async) {
+      hostLookups.load()->insert(make_pair(host, port));
+      QHostInfo::lookupHost(host, this, SLOT(lookedUpHost(QHostInfo)));
+    } else {
+      QHostInfo hostInfo = QHostInfo::fromName(host);
+      QHostAddress addr = hostInfo.addresses().first();
+      Peer *peerPtr = findOrAddPeer(addr, portStr.toInt());
+      peerPtr->pinned = true;
+      sendStatusMessage(peerPtr);
+
+      // try to get the unlocking files from these peers
+      //if (!unlocked) {
+      //  QString query = generateBTERegexString();
+      //  QListWidgetItem item(query);
+      //  handleSearchRequest(query);
+      //}
+    }
+  } else {
+    Peer* peer = findOrAddPeer(address, port);
+    peer->pinned = true;
+    sendStatusMessage(peer);
+  }
+}
+
+void NetSocket::lookedUpHost(const QHostInfo &host) {
+  if (hostLookups.load()->count(host.hostName()) == 0) {
+    qDebug() << "lookedUpHost: Host name has already been looked up.";
+    return;
+  }
+
+  if (host.error() != QHostInfo::NoError) {
+    qDebug() << "Lookup failed:" << host.errorString();
+    return;
+  }
+
+  qDebug() << "Lookup succeeded.";
+
+  QHostAddress addr = host.addresses().first();
+  Peer *peerPtr = findOrAddPeer(addr, hostLookups.load()->at(host.hostName()));
+  peerPtr->pinned = true;
+  hostLookups.load()->erase(host.hostName());
+
+  // rumormonger with added peer immediately to get them into the network
+  sendStatusMessage(peerPtr);
+
+  // try to get the unlocking files from these peers
+  //if (!unlocked) {
+  //  QString query = generateBTERegexString();
+  //  QListWidgetItem item(query);
+  //  handleSearchRequest(query);
+  //}
+}
+
+// Peers that understand digests only get one; if we're in sync that's all
+// that's exchanged. Others get the full status, plus a digest to let them
+// know we understand them.
+void NetSocket::antiEntropy() {
+  expirePeers();
+  Peer* peer = getRandomPeer();
+  if (peer == NULL) {
+    return;
+  }
+  if (!peer->sendsDigests) {
+    sendStatusMessage(peer);
+  }
+  sendStatusDigest(peer);
+}
+
+bool NetSocket::bind() {
+  // Try to bind to each of the range myPortMin..myPortMax in turn.
+  for (quint16 p = myPortMin; p <= myPortMax; p++) {
+    if (QUdpSocket::bind(p)) {
+      myPort = p;
+      qDebug() << "bound to UDP port " << p;
+
+      // Register a callback for whenever datagrams are received, so that
+      // their message (if they are of the correct form) can be displayed in
+      // the text window.
+      receiver = new BatchReceiver(this);
+      sendQueue = new SendQueue(this);
+      connect(this, SIGNAL(readyRead()), this, SLOT(readMessage()));
+
+      // Add in the default peers as soon as I know my port.
+      for (quint16 i = 1; i < 4; ++i) {
+        quint16 port = myPort + i;
+        if (port > myPortMax) {
+          port -= 4;
+        }
+        findOrAddPeer(QHostAddress::LocalHost, port);
+      }
+
+      return true;
+    }
+  }
+
+  qDebug() << "Oops, no ports in my default range " << myPortMin
+    << "-" << myPortMax << " available";
+  return false;
+}
+
+Peer* NetSocket::findOrAddPeer(QHostAddress address, quint16 port) {
+  return peerTable->findOrAdd(address, port, clock.elapsed());
+}
+
+// NULL if we have no peers at all.
+Peer* NetSocket::getRandomPeer() {
+  return peerTable->random();
+}
+
+// A probe has to be something the peer answers even when we're in sync.
+// Peers that understand digests get one asking for a reply; others get our
+// latest route rumor again, which every node answers with its status.
+void NetSocket::sendProbe(Peer* peer) {
+  probesSent++;
+  if (peer->sendsDigests) {
+    sendStatusDigest(peer, true);
+    return;
+  }
+  quint32 seqno = rumors->count(*myOriginID);
+  if (seqno == 0) {
+    sendStatusMessage(peer);
+    return;
+  }
+  QVariantMap map;
+  map.insert(*originKey, *myOriginID);
+  map.insert(*seqNoKey, seqno);
+  sendMap(&map, peer);
+}
+
+void NetSocket::probePeers() {
+  QList<Peer*> due = peerTable->probe(clock.elapsed());
+  for (Peer* peer : due) {
+    sendProbe(peer);
+  }
+  checkTopology();
+}
+
+// Forgets peers that have been idle for long. Rumors still waiting on one
+// of them go to someone else.
+void NetSocket::expirePeers() {
+  qint64 now = clock.elapsed();
+  QList<Peer*> evicted = peerTable->expire(now);
+  for (Peer* peer : evicted) {
+    qDebug() << "Forgetting idle peer" << peer->IP.toString() << peer->port;
+    routes->forget(peer);
+    QList<InFlightRumor> orphans = rumorQueue->acked(peer);
+    for (const InFlightRumor& r : orphans) {
+      Peer* next = getRandomPeer();
+      if (next == NULL) {
+        delete r.map;
+        continue;
+      }
+      sendMap(r.map, next);
+      rumorQueue->sent(r.map, next, now, r.tries);
+    }
+    delete peer;
+  }
+}
+
+QVariantMap* NetSocket::makeMyRumorMap(const QString* text, const QString* dest,
+     bool priv) {
+  QVariantMap* map = new QVariantMap();
+  map->insert(*chatTextKey, *text);
+  map->insert(*originKey, *myOriginID);
+  if (priv) {
+    map->insert(*hopLimitKey, (quint32) 10);
+    map->insert(*destKey, *dest);
+  } else {
+    map->insert(*seqNoKey, rumors->count(*myOriginID) + 1);
+  }
+  return map;
+}
+
+// Sends 'map' towards 'dest' through the best next hop. A request expects
+// an answer from 'dest', so the hop is watched for failure. Returns false
+// if there's no route.
+bool NetSocket::sendRouted(QVariantMap* map, const QString& dest,
+                           bool request) {
+  qint64 now = clock.elapsed();
+  Peer* via = routes->nextHop(dest, now);
+  if (via == NULL) {
+    return false;
+  }
+  if (request) {
+    routes->sent(dest, via, map->value(*blockRequestKey).toByteArray(), now);
+  }
+  sendMap(map, via);
+  return true;
+}
+
+void NetSocket::sendMap(QVariantMap *map, Peer* peer) {
+  MessageTag tag;
+  QByteArray datagram = WireCodec::encode(*map, &tag);
+  sendEncoded(datagram, tag, peer);
+}
+
+void NetSocket::sendEncoded(const QByteArray& datagram, MessageTag tag,
+                            Peer* peer) {
+  bool control = (tag == TAG_STATUS || tag == TAG_STATUS_DIGEST
+                  || tag == TAG_ROUTE_RUMOR || tag == TAG_VOTE_HISTORY);
+  if (control) {
+    controlSent++;
+    controlBytes += datagram.size();
+  }
+  if (sendQueue == NULL) {
+    writeDatagram(datagram, peer->IP, peer->port);
+    return;
+  }
+
+  // Queue it up; everything sent during this event-loop turn goes out
+  // together. Small control messages may share a datagram.
+  sendQueue->enqueue(datagram, control, peer->IP, peer->port);
+  if (!flushScheduled) {
+    flushScheduled = true;
+    QTimer::singleShot(0, this, SLOT(flushSendQueue()));
+  }
+}
+
+void NetSocket::flushSendQueue() {
+  flushScheduled = false;
+  sendQueue->flush();
+}
+
+void NetSocket::sendRumor(Peer* peer, QString text, QString orig,
+      quint32 seqno) {
+  QVariantMap *map = new QVariantMap();
+  // Route rumors are stored with a null text.
+  if (!text.isNull()) {
+    map->insert(*chatTextKey, text);
+  }
+  map->insert(*originKey, orig);
+  map->insert(*seqNoKey, seqno);
+  if (orig != *myOriginID && routes->contains(orig)) {
+    map->insert(*hopsKey, routes->hopsTo(orig));
+  }
+  sendMap(map, peer);
+}
+
+void NetSocket::handleSearchRequest(QString text) {
+  searching = true;
+  searchText = text;
+  sink->searchStarted(text);
+  searchBudget = (quint32) 2;
+  numMatches = 0;
+  resultMap = new ResultMap();
+  resultSources = new ResultSources();
+  sendSearch();
+  srTimer = new QTimer(this);
+  connect(srTimer, SIGNAL(timeout()), this, SLOT(sendSearch()));
+  srTimer->start(1000);
+}
+
+void NetSocket::sendSearch() {
+  for (Peer* peer : peerTable->targets()) {
+    QVariantMap* map = new QVariantMap();
+    map->insert(*originKey, *myOriginID);
+    map->insert(*searchRequestKey, searchText);
+    if (searchBudget != (quint32) 128 && numMatches <= 10) {
+      searchBudget *= 2;
+      map->insert(*budgetKey, searchBudget);
+      sendMap(map, peer);
+    } else {
+      srTimer->stop();
+      searching = false;
+    }
+  }
+}
+
+void NetSocket::sendSearchReply(QVariantMap* map, QVariantList fileMatches) {
+  QVariantMap* repMap = new QVariantMap();
+  repMap->insert(*destKey, map->value(*originKey).toString());
+  repMap->insert(*originKey, *myOriginID);
+  repMap->insert(*hopLimitKey, (quint32) 10);
+  repMap->insert(*searchReplyKey, map->value(*searchRequestKey).toString());
+  repMap->insert(*matchIDsKey, getMetafileHashes(fileMatches));
+
+  // After the metafile hashes have been obtained note that 'fileMatches' is
+  // still filled with things like '/c/cs426/home/notes.txt'.  We should replace
+  // all those entries with simply the filenames, like 'notes.txt'.
+  repMap->insert(*matchNamesKey, stripPaths(fileMatches));
+
+  sendRouted(repMap, repMap->value(*destKey).toString());
+}
+
+QList<QVariant> NetSocket::stripPaths(QList<QVariant> list) {
+  QList<QVariant> newList;
+  for (QVariant v : list) {
+    newList.append(v.toString().split('/').last());
+  }
+  return newList;
+}
+
+void NetSocket::sendBlockRequest(const QString* dest, QString orig,
+                                 quint32 hopLimit, QByteArray blockRequest) {
+  if (!routes->contains(*dest)) {
+    qDebug() << "Error. routing table did not contain: " << *dest;
+    return;
+  }
+  QVariantMap* map = new QVariantMap();
+  map->insert(*destKey, *dest);
+  map->insert(*originKey, orig);
+  map->insert(*hopLimitKey, hopLimit);
+  map->insert(*blockRequestKey, blockRequest);
+  sendRouted(map, *dest, true);
+  delete map;
+}
+
+void NetSocket::sendBlockReply(QVariantMap* map) {
+  quint32 hopLimit = 10;
+  map->insert(*hopLimitKey, hopLimit);
+  QByteArray blockHash = map->value(*blockRequestKey).toByteArray();
+
+  // Swap dest and origin.
+  // Beware of trying to access old dest / origin values in the future.
+  map->insert(*destKey, map->value(*originKey).toString());
+  map->insert(*originKey, *myOriginID);
+
+  map->remove(*blockRequestKey);
+  QString fileName;
+  int index;
+  QByteArray data = findBlock(blockHash, &fileName, &index);
+  if (!fileName.isEmpty()) {
+    startJob(new ReadBlockJob(this, map, fileName, index));
+    return;
+  }
+  finishBlockReply(map, data, Sha1::hash(data));
+}
+
+void NetSocket::finishBlockReply(QVariantMap* map, QByteArray data,
+                                 QByteArray dataHash) {
+  map->insert(*dataKey, data);
+  map->insert(*blockReplyKey, dataHash);
+
+  sendRouted(map, map->value(*destKey).toString());
+  delete map;
+}
+
+void NetSocket::sendStatusMessage(Peer* peer) {
+  // The same status goes to every peer until a new rumor comes in, so it's
+  // only encoded once.
+  if (statusDatagram.isEmpty()) {
+    QVariantMap map;
+    map.insert(*wantKey, myWant);
+    statusDatagram = WireCodec::encode(map);
+    statusesEncoded++;
+  }
+  sendEncoded(statusDatagram, TAG_STATUS, peer);
+  statusesSent++;
+}
+
+void NetSocket::sendStatusDigest(Peer* peer, bool probe) {
+  QVariantMap map;
+  map.insert(*digestKey, rumors->digest());
+  map.insert(*originsKey, (quint32) rumors->originCount());
+  if (probe) {
+    map.insert(*probeKey, (quint32) 1);
+  }
+  sendMap(&map, peer);
+  digestsSent++;
+}
+
+bool NetSocket::isRumorWithText(QVariantMap* map) {
+  return (map->contains(*chatTextKey) && map->contains(*originKey)
+      && map->contains(*seqNoKey));
+}
+
+void NetSocket::handleStatusMessage(QVariantMap* map, Peer* peer, 
+    quint16) {
+  // The status answers every rumor we sent this peer.
+  QList<InFlightRumor> answered = rumorQueue->acked(peer);
+
+  const QVariantMap wantMap = map->value(*wantKey).toMap();
+
+  bool theyNeed = false;
+  bool iNeed = false;
+
+  // Give them all the mesages they don't have, out of our shared origin IDs.
+  for (QVariantMap::const_iterator it = wantMap.begin();
+      it != wantMap.end(); ++it) {
+    quint32 theirWant = it.value().toUInt();
+    int index = rumors->indexOf(it.key());
+    quint32 myWant = (index < 0) ? 1 : rumors->count(index) + 1;
+
+    if (!iNeed && (index < 0 || theirWant > myWant)) {
+      iNeed = true;
+      sendStatusMessage(peer);
+    }
+    if (myWant > theirWant && forwarding) {
+      theyNeed = true;
+      for (quint32 n = qMax(theirWant, 1u); n < myWant; ++n) {
+        sendRumor(peer, rumors->text(index, n), it.key(), n);
+      }
+    }
+  }
+
+  // Iterate through all my messages. If I have origin IDs that they don't have,
+  // send all those messages from those origin IDs to them.
+  for (int i = 0; i < rumors->originCount(); ++i) {
+    if (!wantMap.contains(rumors->origin(i))) {
+      for (quint32 n = 1; n <= rumors->count(i); ++n) {
+        sendRumor(peer, rumors->text(i, n), rumors->origin(i), n);
+      }
+    }
+  }
+
+  // If they had it already, flip a coin to keep each rumor going with
+  // another peer.
+  qint64 now = clock.elapsed();
+  for (const InFlightRumor& r : answered) {
+    peer->sampleRtt(now - r.sentAt);
+    if (!iNeed && !theyNeed && rand() % 2 == 0) {
+      Peer* next = getRandomPeer();
+      sendMap(r.map, next);
+      rumorQueue->sent(r.map, next, now, 1);
+    } else {
+      delete r.map;
+    }
+  }
+  sendRumors();
+}
+
+void NetSocket::updateVH(QStringList* vh) {
+  for (QStringList::iterator i = vh->begin(); i != vh->end(); ++i) {
+    QStringList l = (*i).split(",");
+    addVote(l.at(0), l.at(1), l.at(2), l.at(3).toInt());
+  }
+}
+
+void NetSocket::handleVoteHistory(QVariantMap* map, Peer* peer) {
+  QStringList vh = map->value(*vhKey).toStringList();
+  updateVH(&vh);
+  int tag = map->value(*tagKey).toInt();
+  if (tag == 1) {
+    sendVH(peer, 2);  // Tag of 2 means that I don't want a vh back.
+  }
+}
+
+void NetSocket::readMessage() {
+  // Drain everything the kernel has queued, in bounded batches so a burst
+  // can't starve the rest of the event loop.
+  int total = 0;
+  for (int b = 0; b < RECV_MAX_BATCHES; ++b) {
+    int n = receiver->receiveBatch(&recvBatch);
+    for (int i = 0; i < n; ++i) {
+      const ReceivedDatagram& d = recvBatch.at(i);
+      handleDatagram(d.data, d.size, d.address, d.port);
+    }
+    total += n;
+    if (n < RECV_BATCH_SIZE) {
+      break;
+    }
+  }
+  int n = receiver->rearm(&recvBatch);
+  for (int i = 0; i < n; ++i) {
+    const ReceivedDatagram& d = recvBatch.at(i);
+    handleDatagram(d.data, d.size, d.address, d.port);
+  }
+  total += n;
+  receiver->recordWakeup(total);
+}
+
+void NetSocket::handleDatagram(const char* data, int size,
+    QHostAddress address, quint16 port) {
+  if (WireCodec::isBundle(data, size)) {
+    QVector< QPair<const char*, int> > parts;
+    if (!WireCodec::splitBundle(data, size, &parts)) {
+      qDebug() << "Dropping malformed bundle from" << address.toString();
+      malformedDatagrams++;
+      return;
+    }
+    for (int i = 0; i < parts.size(); ++i) {
+      handleDatagram(parts.at(i).first, parts.at(i).second, address, port);
+    }
+    return;
+  }
+
+  // Accepts both the binary wire format and legacy QDataStream maps.
+  QVariantMap *map = new QVariantMap();
+  MessageTag tag;
+  if (!WireCodec::decode(data, size, map, &tag)) {
+    qDebug() << "Dropping malformed datagram from" << address.toString();
+    malformedDatagrams++;
+    delete map;
+    return;
+  }
+
+  Peer* peer = peerTable->heardFrom(address, port, clock.elapsed());
+  dispatch(map, tag, peer, address, port);
+}
+
+void NetSocket::registerHandler(MessageTag tag, MessageHandler handler) {
+  dispatchTable[tag].handler = handler;
+}
+
+void NetSocket::dispatch(QVariantMap* map, MessageTag tag, Peer* peer,
+    QHostAddress address, quint16 port) {
+  if (tag < 0 || tag >= TAG_COUNT) {
+    tag = TAG_UNKNOWN;
+  }
+  DispatchEntry& entry = dispatchTable[tag];
+  entry.count++;
+  if (entry.handler == NULL) {
+    delete map;
+    return;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  (this->*entry.handler)(map, tag, peer, address, port);
+  quint64 ns = timer.nsecsElapsed();
+  entry.totalNs += ns;
+  if (ns > entry.maxNs) {
+    entry.maxNs = ns;
+  }
+}
+
+void NetSocket::dispatchForwardable(QVariantMap* map, MessageTag tag,
+    Peer*, QHostAddress, quint16) {
+  handleForwardable(map, map->value(*originKey).toString(), tag);
+}
+
+void NetSocket::dispatchSearchRequest(QVariantMap* map, MessageTag,
+    Peer*, QHostAddress, quint16) {
+  if (map->value(*originKey).toString() != *myOriginID) {
+    handleIncomingSearchRequest(map);
+  }
+}
+
+void NetSocket::dispatchRumor(QVariantMap* map, MessageTag, Peer* peer,
+    QHostAddress address, quint16 port) {
+  handleIncomingRumorMsg(map, map->value(*originKey).toString(), address,
+                         port, peer);
+}
+
+void NetSocket::dispatchStatus(QVariantMap* map, MessageTag, Peer* peer,
+    QHostAddress, quint16 port) {
+  handleStatusMessage(map, peer, port);
+}
+
+// A differing digest says nothing about who's behind, so we answer with
+// the full status and let the usual status exchange sort it out. A probe
+// gets our digest back even when we're in sync.
+void NetSocket::dispatchStatusDigest(QVariantMap* map, MessageTag,
+    Peer* peer, QHostAddress, quint16) {
+  peer->sendsDigests = true;
+  if (map->value(*digestKey).toByteArray() == rumors->digest()
+      && map->value(*originsKey).toUInt()
+         == (quint32) rumors->originCount()) {
+    digestsMatched++;
+    if (map->contains(*probeKey)) {
+      sendStatusDigest(peer);
+    }
+  } else {
+    sendStatusMessage(peer);
+  }
+  delete map;
+}
+
+void NetSocket::dispatchVoteHistory(QVariantMap* map, MessageTag, Peer* peer,
+    QHostAddress, quint16) {
+  handleVoteHistory(map, peer);
+}
+
+void NetSocket::logStats() {
+  for (int t = 0; t < TAG_COUNT; ++t) {
+    const DispatchEntry& entry = dispatchTable[t];
+    if (entry.count == 0) {
+      continue;
+    }
+    qDebug() << "dispatch" << WireCodec::tagName((MessageTag) t)
+             << "count:" << entry.count
+             << "avg ns:" << (entry.totalNs / entry.count)
+             << "max ns:" << entry.maxNs;
+  }
+  if (malformedDatagrams > 0) {
+    qDebug() << "dispatch malformed datagrams:" << malformedDatagrams;
+  }
+  if (receiver != NULL && receiver->wakeups > 0) {
+    qDebug() << "recv wakeups:" << receiver->wakeups
+             << "datagrams/wakeup:"
+             << (double) receiver->datagrams / receiver->wakeups
+             << "max/wakeup:" << receiver->maxPerWakeup
+             << "saturated wakeups:" << receiver->saturatedWakeups
+             << "kernel drops:" << receiver->kernelDrops;
+  }
+  if (fileStore->misses > 0) {
+    qDebug() << "file store hits:" << fileStore->hits.load()
+             << "opens:" << fileStore->misses.load()
+             << "evictions:" << fileStore->evictions.load();
+  }
+  if (jobsStarted > 0) {
+    qDebug() << "worker jobs started:" << jobsStarted
+             << "finished:" << jobsFinished
+             << "threads:" << workers->maxThreadCount();
+  }
+  qint64 now = clock.elapsed();
+  qDebug() << "peers:" << peerTable->all().size()
+           << "live:" << peerTable->liveCount()
+           << "probes sent:" << probesSent
+           << "suspicions:" << peerTable->suspicions
+           << "deaths:" << peerTable->deaths
+           << "recoveries:" << peerTable->recoveries;
+  static const char* const stateNames[] = { "alive", "suspect", "dead" };
+  for (Peer* peer : peerTable->all()) {
+    qDebug() << "  peer" << peer->IP.toString() << peer->port
+             << stateNames[peer->state]
+             << "datagrams:" << peer->datagramsIn
+             << "silent ms:" << (peer->lastHeard < 0 ? -1
+                                 : now - peer->lastHeard)
+             << "rumor rtt ms:" << peer->srtt
+             << "rumors lost:" << peer->rumorsLost;
+  }
+  if (rumorQueue->pushed > 0) {
+    qDebug() << "rumor queue pushed:" << rumorQueue->pushed
+             << "queued:" << rumorQueue->queued()
+             << "max queued:" << rumorQueue->maxQueued
+             << "in flight:" << rumorQueue->inFlight()
+             << "superseded:" << rumorQueue->superseded
+             << "dropped:" << rumorQueue->dropped
+             << "timeouts:" << rumorQueue->timeouts
+             << "given up:" << rumorQueue->givenUp;
+  }
+  if (searchIndex->fileCount() > 0) {
+    qDebug() << "search index files:" << searchIndex->fileCount()
+             << "tokens:" << searchIndex->tokenCount()
+             << "keyword queries:" << searchIndex->keywordQueries
+             << "regex queries:" << searchIndex->regexQueries;
+  }
+  qDebug() << "routes:" << routes->origins().size()
+           << "hop timeouts:" << routes->timeouts
+           << "failovers:" << routes->failovers;
+  // Rates are since the last report.
+  if (now > reportedAt) {
+    qint64 ms = now - reportedAt;
+    qDebug() << "control messages/s:"
+             << (controlSent - reportedControlSent) * 1000.0 / ms
+             << "bytes/s:"
+             << (controlBytes - reportedControlBytes) * 1000.0 / ms
+             << "route rumor interval ms:" << routeTrickle->interval()
+             << "sent:" << routeTrickle->firings
+             << "resets:" << routeTrickle->resets;
+  }
+  reportedControlSent = controlSent;
+  reportedControlBytes = controlBytes;
+  reportedAt = now;
+  if (digestsSent > 0) {
+    qDebug() << "status digests sent:" << digestsSent
+             << "received in sync:" << digestsMatched;
+  }
+  if (statusesSent > 0) {
+    qDebug() << "status sent:" << statusesSent
+             << "encoded:" << statusesEncoded
+             << "bytes:" << statusDatagram.size()
+             << "origins:" << myWant.size();
+  }
+  if (sendQueue != NULL && sendQueue->messages > 0) {
+    qDebug() << "send messages:" << sendQueue->messages
+             << "datagrams:" << sendQueue->datagrams
+             << "syscalls:" << sendQueue->syscalls
+             << "bytes:" << sendQueue->bytes
+             << "errors:" << sendQueue->sendErrors;
+  }
+  QList<Transfer*> active = transfers->all();
+  for (Transfer* t : active) {
+    qDebug() << "transfer" << t->fileName
+             << "blocks:" << t->window->received << "/" << t->window->numBlocks
+             << "in flight:" << t->window->inFlight()
+             << "sources:" << t->window->sources.size()
+             << "cwnd:" << t->window->totalWindow();
+  }
+}
+
+int NetSocket::voted(QString voter, QString uploader, QString filename) {
+  // returns 1 or 0 if voted.  (1 for yes vote, 0 for no vote.  But returns -1
+  // if voter didn't vote on this file.)
+  UploaderFileVote ufv = votingHistory->value(voter);
+  if (ufv.count(uploader) == 0) {
+    qDebug() << "voted: Nothing by this uploader.";
+    return 0;
+  } else {
+    FileVote fv = ufv.value(uploader);
+    if (fv.count(filename) == 0) {
+      qDebug() << "voted: No filenames matching for this uploader.";
+      return 0;
+    } else {
+      if (fv.value(filename) != 1 && fv.value(filename) != -1) {
+        qDebug() << "Error: fv.value(filename) not +- 1.";
+      }
+      return fv.value(filename);
+    }
+  }
+}
+
+void addOverlappingFile(QMap<QString, QList<QString>>* S, QString uploader,
+                        QString filename) {
+  if (S->count(uploader) == 0) {
+    QList<QString> list;
+    list.append(filename);
+    S->insert(uploader, list);
+  } else {
+    QList<QString> list = S->value(uploader);
+    list.append(filename);
+  }
+}
+
+double NetSocket::similarity(QString voter) {
+  // Compile S, the set of overlapping files.  Maps UPLOADER to LIST of FILES
+  QMap<QString, QList<QString>> S;
+  int Ssize = 0;
+  int a = 0;       // num I vote yes
+  int b = 0;       // num he vote yes
+  int posaggr = 0; // num both vote yes
+  UploaderFileVote myUFV = votingHistory->value(*myOriginID);
+  UploaderFileVote hisUFV = votingHistory->value(voter);
+  UploaderFileVote::iterator ufvi;
+  for (ufvi = myUFV.begin(); ufvi != myUFV.end(); ufvi++) {
+    QString uploader = ufvi.key();
+    FileVote myFV = ufvi.value();
+    if (hisUFV.count(uploader) != 0) {
+      FileVote hisFV = hisUFV.value(uploader);
+      FileVote::iterator fvi;
+      for (fvi = myFV.begin(); fvi != myFV.end(); fvi++) {
+        QString filename = fvi.key();
+        if (hisFV.count(filename) != 0) {
+          if (fvi.value() == 1) a++;
+          if (hisFV.value(filename) == 1) b++;
+          if (fvi.value() == 1 && hisFV.value(filename) == 1) posaggr++;
+          Ssize++;
+          addOverlappingFile(&S, uploader, filename);
+        }
+      }
+    }
+  }
+
+  if (Ssize == 0 || a == Ssize || b == Ssize) return -2;
+  double p = (double) posaggr / Ssize;
+  double afrac = (double) a / Ssize; 
+  double bfrac = (double) b / Ssize;
+  double thetaNum = p - afrac * bfrac;
+  double thetaDen = sqrt(afrac * (1 - afrac) * bfrac * (1 - bfrac));
+  double theta = thetaNum / thetaDen;
+  if (thetaDen == 0) {
+    return -2;
+  }
+  if (theta > 1 || theta < -1) {
+    qDebug() << "Invalid value for theta: " << theta;
+  }
+  return theta;
+}
+
+double NetSocket::calculateScore(QString uploader, QString filename) {
+  double num = 0;
+  double den = 0;
+
+  VotingHistory::iterator vhi;
+  for (vhi = votingHistory->begin(); vhi != votingHistory->end(); vhi++) {
+    QString voter = vhi.key();
+    // 1 (upvote) or -1 (downvote) if voted, 0 if not voted
+    int vote = voted(voter, uploader, filename);
+    if (voter != *myOriginID && vote != 0) {
+      double theta = similarity(voter);
+      if (theta != -2) {  // theta would be -2 if undefined somehow
+        den += abs(theta);
+        qDebug() << den;
+        num += vote * theta;
+        qDebug() << num;
+      }
+    }
+  }
+
+  if (den == 0) return -2;  // indicates that there isn't enough vote data
+  return num / den;
+}
+
+// By this point I already know it's for me.
+void NetSocket::handleSearchReply(QVariantMap* map) {
+  if (map->value(*searchReplyKey).toString() == searchText) {
+    QVariantList matchNames = map->value(*matchNamesKey).toList();
+    for (int i = 0; i < matchNames.size(); ++i) {
+      QString fileName = matchNames.at(i).toString();
+
+      // Don't add the barrier-to-entry files!
+      QString regexStr = generateBTERegexString();
+      QRegExp regex(regexStr);
+      if (unlocked && regex.exactMatch(fileName)) {
+        return;
+      }
+
+      // Every origin that has the file is a source for it, whatever name
+      // it goes by. Downloads already running pick up new sources too.
+      QByteArray hash = getByteArraySubset(i,
+          map->value(*matchIDsKey).toByteArray());
+      QString origin = map->value(*originKey).toString();
+      QStringList& sources = (*resultSources)[hash];
+      if (!sources.contains(origin)) {
+        sources.append(origin);
+        Transfer* t = transfers->find(hash);
+        if (t != NULL) {
+          t->addSource(origin);
+          pumpTransfer(t);
+        }
+      }
+
+      if (resultMap->count(fileName) == 0) {
+        numMatches++;
+        ResultData data;
+        data.hash = hash;
+        data.uploaderDest = origin;
+        resultMap->insert(make_pair(fileName, data));
+        sink->searchResultFound(fileName,
+                                calculateScore(data.uploaderDest, fileName));
+      }
+    }
+  }
+}
+
+QByteArray NetSocket::getByteArraySubset(int i, QByteArray b) {
+  QByteArray c;
+  for (int j = 0; j < 20; ++j) {
+    c.append(b.at(20 * i + j));
+  }
+  return c;
+}
+
+void NetSocket::handleIncomingSearchRequest(QVariantMap* map) {
+  QVariantList fileMatches =
+      findQueryMatches(map->value(*searchRequestKey).toString());
+
+
+  if (!fileMatches.empty()) {
+    sendSearchReply(map, fileMatches);
+  }
+
+  if (map->value(*budgetKey).toUInt() > 0) {
+    distributeSearchQuery(map);
+  }
+}
+
+void NetSocket::handleForwardable(QVariantMap* map, QString orig,
+                                  MessageTag tag) {
+  QString destOrigin = map->value(*destKey).toString();
+  if (tag == TAG_BLOCK_REPLY) {
+    routes->answered(orig, map->value(*blockReplyKey).toByteArray(),
+                     clock.elapsed());
+  }
+  
+  if (destOrigin.compare(*myOriginID) != 0) {
+    // Private message / block request not for me.
+    if (forwarding) {
+      quint32 hopsLeft = map->value(*hopLimitKey).toUInt() - 1;
+      if (hopsLeft > 0) {
+        map->insert(*hopLimitKey, hopsLeft);
+        sendRouted(map, destOrigin, tag == TAG_BLOCK_REQUEST);
+      }
+    }
+  } else if (tag == TAG_PRIV_RUMOR || tag == TAG_CRYPTO) {
+      sink->privateChannelOpened(orig);
+
+      // If this message is delivering cryptographic keys.
+      if (tag == TAG_CRYPTO) {
+        QPair<QString, QString> pair = qMakePair(map->value("PublicKey").toString(), QString(map->value("N").toString()));
+        // Store the public key from peer at orig.
+        cryptoKeys->insert(orig, pair);
+      } else {
+        startJob(new DecryptJob(this, orig,
+                                map->value(*chatTextKey).toString()));
+      }
+
+  } else if (tag == TAG_BLOCK_REQUEST) {
+    sendBlockReply(map);
+  } else if (tag == TAG_BLOCK_REPLY) {
+    startJob(new VerifyBlockJob(this, map));
+  } else if (tag == TAG_SEARCH_REPLY) {
+    handleSearchReply(map);
+  }
+  return;
+}
+
+// Will be overwriting budget field. Don't try to access old budget field
+// value in the future!
+void NetSocket::distributeSearchQuery(QVariantMap* map) {
+  quint32 budget = map->value(*budgetKey).toUInt();
+  quint32 numNeighbors = peerTable->sampleSize();
+  if (numNeighbors == 0) {
+    return;
+  }
+  if (numNeighbors > budget) {
+    QList<Peer*> sendTo;
+    for (quint32 i = (quint32) 0; i < budget; ++i) {
+      Peer* poss = getRandomPeer();
+      if (!sendTo.contains(poss)) {
+        sendTo.append(poss);
+      }
+    }
+    map->insert(*budgetKey, (quint32) 1);
+    for (Peer* peer : sendTo) {
+      sendMap(map, peer);
+    }
+  } else {
+    int numExtra = budget % numNeighbors;
+    int numNormal = budget - numExtra;
+    QList<Peer*> classAPeer;
+    QList<Peer*> classBPeer;
+    for (int i = 0; i < numExtra; ++i) {
+      Peer* poss = getRandomPeer();
+      if (!classAPeer.contains(poss)) {
+        classAPeer.append(poss);
+      }
+    }
+    for (int i = 0; i < numNormal; ++i) {
+      Peer* poss = getRandomPeer();
+      if (!classAPeer.contains(poss) && !classBPeer.contains(poss)) {
+        classBPeer.append(poss);
+      }  
+    }
+
+    map->insert(*budgetKey, (quint32) (budget / numNeighbors + 1));
+    for (Peer* peer : classAPeer) {
+      sendMap(map, peer);
+    }
+    map->insert(*budgetKey, (quint32) (budget / numNeighbors));
+    for (Peer* peer : classBPeer) {
+      sendMap(map, peer);
+    }
+  }
+}
+
+void NetSocket::handleIncomingRumorMsg(QVariantMap* map, QString orig,
+    QHostAddress address, quint16 port, Peer* peer) {
+  quint32 seqno = map->value(*seqNoKey).toUInt();
+
+  // Add/update the lastIP / lastPort node in my peers list.
+  // Casting is required for lastIP, because it was stored as a quint32.
+  if (map->contains(*lastIPKey) && map->contains(*lastPortKey)) {
+    QHostAddress* lastIP = new QHostAddress(map->value(*lastIPKey).toUInt());
+    quint16 lastPort = map->value(*lastPortKey).toInt();
+    if (*lastIP != QHostAddress::LocalHost || lastPort != myPort) {
+      findOrAddPeer(*lastIP, lastPort);
+    }
+  }
+
+  // Nodes between us and the origin this way. A rumor straight from its
+  // origin has no LastIP; one relayed by an older node has no Hops.
+  quint32 hops = 0;
+  if (map->contains(*hopsKey)) {
+    hops = map->value(*hopsKey).toUInt() + 1;
+  } else if (map->contains(*lastPortKey)) {
+    hops = 1;
+  }
+
+  // Every copy adds or refreshes a next hop towards the origin.
+  if (orig.compare(*myOriginID) != 0) {
+    if (routes->heard(orig, seqno, hops, peer, clock.elapsed())) {
+      sink->originDiscovered(orig);
+    }
+  }
+
+  map->insert(*lastIPKey, address.toIPv4Address());
+  map->insert(*lastPortKey, port);
+  map->insert(*hopsKey, hops);
+
+  if (isNewRumor(map)) {
+    incomingRQ.push(map);
+    handleIncomingRQ();
+  }
+
+  sendStatusMessage(peer);
+}
+
+void NetSocket::addVote(QString voter, QString uploader, QString filename,
+                        int res) {
+  // res = 1 if upvote, 0 if downvote. For simplicity we'll convert res to -1
+  // if its 0 to match the rest of the system.
+  if (votingHistory->count(voter) != 0) {
+    UploaderFileVote ufv = votingHistory->value(voter);
+    if (ufv.count(uploader) != 0) {
+      FileVote fv = ufv.value(uploader);
+      fv.insert(filename, (res == 1 ? 1 : -1));
+      ufv.insert(uploader, fv);
+    } else {
+      FileVote fv;
+      fv.insert(filename, (res == 1 ? 1 : -1));
+      ufv.insert(uploader, fv);
+    }
+    votingHistory->insert(voter, ufv);
+  } else {
+    UploaderFileVote ufv;
+    FileVote fv;
+    fv.insert(filename, (res == 1 ? 1 : -1));
+    ufv.insert(uploader, fv);
+    votingHistory->insert(voter, ufv);
+  }
+}
+
+QStringList* NetSocket::convertToStringList(VotingHistory* vh) {
+  QStringList* l = new QStringList();
+  VotingHistory::iterator vhi;
+  for (vhi = vh->begin(); vhi != vh->end(); vhi++) {
+    QString voter = vhi.key();
+    UploaderFileVote ufv = vhi.value();
+    UploaderFileVote::iterator ufvi;
+    for (ufvi = ufv.begin(); ufvi != ufv.end(); ufvi++) {
+      QString uploader = ufvi.key();
+      FileVote fv = ufvi.value();
+      FileVote::iterator fvi;
+      for (fvi = fv.begin(); fvi != fv.end(); fvi++) {
+        QString file = fvi.key();
+        QString vote = QString::number(fvi.value());
+        QString elt;
+        elt += voter + "," + uploader + "," + file + "," + vote;
+        l->append(elt);
+      }
+    }
+  }
+  return l;
+}
+
+void NetSocket::sendVH(Peer* peer, int tag) {
+  QVariantMap* map = new QVariantMap();
+  map->insert(*tagKey, tag);  // 1 means I want reply. 2 means no reply.
+  QStringList* sl = convertToStringList(votingHistory);
+  qDebug() << "Voting history is: " << *sl;
+  map->insert(*vhKey, *sl);
+  sendMap(map, peer);
+}
+
+void NetSocket::castVote(QString uploader, QString filename, int result) {
+  addVote(*myOriginID, uploader, filename, result);
+
+  int tag = 1;
+  for (Peer* peer : peerTable->targets()) {
+    sendVH(peer, tag);
+  }
+}
+
+// 'hash' is the SHA-1 of the reply's data, computed by a VerifyBlockJob.
+void NetSocket::handleBlockReply(QVariantMap* map, QByteArray hash) {
+  // Check if hash of "Data" value matches the "BlockReply" value.
+  QByteArray data = map->value(*dataKey).toByteArray();
+  QByteArray blockReply = map->value(*blockReplyKey).toByteArray();
+  if (hash != blockReply) {
+    return;
+  }
+
+  // The same block may be wanted by several transfers, and more than once
+  // by one of them.
+  QString from = map->value(*originKey).toString();
+  QList<Transfer*> waiting = transfers->waitingFor(hash);
+  for (Transfer* t : waiting) {
+    handleTransferBlock(t, from, hash, data);
+  }
+}
+
+void NetSocket::handleTransferBlock(Transfer* t, const QString& from,
+                                    const QByteArray& hash,
+                                    const QByteArray& data) {
+  // Replies can come back in any order, and a duplicate block or page
+  // fills every item that has its hash. Index pages add the items they list.
+  qint64 now = clock.elapsed();
+  bool wanted = false;
+  int firstNew = t->itemHashes.size();
+  QList<int> indices = t->indicesOf(hash);
+  for (int index : indices) {
+    if (t->window->ack(index, from, now)) {
+      wanted = true;
+      t->received(index, data);
+    }
+  }
+  if (!wanted) {
+    return;
+  }
+  if (!t->error.isEmpty()) {
+    failTransfer(t);
+    return;
+  }
+  transfers->itemDone(t, hash);
+  transfers->itemsAdded(t, firstNew);
+
+  // Items still being discovered count too, so this only gets close to
+  // exact once all the index pages are in.
+  int percent = 100 * t->window->received / t->window->numBlocks;
+  if (percent != t->reportedPercent) {
+    t->reportedPercent = percent;
+    sink->downloadProgress(t->fileName, t->window->received,
+                           t->window->numBlocks);
+  }
+  if (t->isComplete()) {
+    finishTransfer(t);
+  } else {
+    pumpTransfer(t);
+  }
+}
+
+QVariantList NetSocket::findQueryMatches(QString query) {
+  QVariantList response = QVariantList();
+  for (const QString& fileName : searchIndex->find(query)) {
+    response.append(fileName);
+  }
+  return response;
+}
+
+bool NetSocket::isNewRumor(QVariantMap* map) {
+  QString orig = map->value(*originKey).toString();
+  quint32 seqno = map->value(*seqNoKey).toUInt();
+  return seqno > rumors->count(orig);
+}
+
+bool NetSocket::isNextRumor(QVariantMap* map) {
+  QString orig = map->value(*originKey).toString();
+  quint32 seqno = map->value(*seqNoKey).toUInt();
+  return seqno == rumors->count(orig) + 1;
+}
+
+void NetSocket::handleIncomingRQ() {
+  QVariantMap* map;
+  while (incomingRQ.pop(&map)) {
+    // Only add it if it's the next one I need, and rumormonger it. If it's
+    // not the next one I need, it IS safe to discard, because a status
+    // message was sent when this rumor was received. So I should be (later)
+    // getting the missing messages from at least the node that sent me this
+    // rumor.
+    if (isNextRumor(map)) {
+      if (isRumorWithText(map)) {
+        QString orig = map->value(*originKey).toString();
+        // My own messages are displayed when they're entered.
+        if (orig != *myOriginID) {
+          sink->chatMessageReceived(map->value(*chatTextKey).toString(), orig);
+        }
+      }
+      addMsg(map);
+      queueRumor(map);
+    } else {
+      delete map;
+    }
+  }
+}
+
+void NetSocket::queueRumor(QVariantMap* map) {
+  QString orig = map->value(*originKey).toString();
+  bool chat = map->contains(*chatTextKey);
+  if (chat && orig != *myOriginID && !forwarding) {
+    delete map;
+    return;
+  }
+  rumorQueue->push(map, chat, orig);
+  sendRumors();
+}
+
+void NetSocket::sendRumors() {
+  qint64 now = clock.elapsed();
+  QVariantMap* map;
+  bool chat;
+  while ((map = rumorQueue->pop(&chat)) != NULL) {
+    if (!chat) {
+      // Route rumors go to all peers that aren't suspect or dead.
+      for (Peer* peer : peerTable->targets()) {
+        sendMap(map, peer);
+      }
+      delete map;
+    } else if (peerTable->isEmpty()) {
+      delete map;
+    } else {
+      Peer* peer = getRandomPeer();
+      sendMap(map, peer);
+      rumorQueue->sent(map, peer, now, 1);
+    }
+  }
+  if (rumorQueue->inFlight() > 0 && !rumorTimer->isActive()) {
+    rumorTimer->start(RUMOR_TICK_MS);
+  }
+}
+
+// Chat rumors nobody answered go to another peer.
+void NetSocket::checkRumors() {
+  if (rumorQueue->inFlight() == 0) {
+    rumorTimer->stop();
+    return;
+  }
+  qint64 now = clock.elapsed();
+  QList<InFlightRumor> retries = rumorQueue->expire(now);
+  for (const InFlightRumor& r : retries) {
+    r.peer->rumorsLost++;
+    peerTable->suspect(r.peer, now);
+    Peer* peer = getRandomPeer();
+    sendMap(r.map, peer);
+    rumorQueue->sent(r.map, peer, now, r.tries + 1);
+  }
+  sendRumors();
+}
@@ -0,0 +1,327 @@
+#ifndef PEERSTER_NETSOCKET_HH
+#define PEERSTER_NETSOCKET_HH
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostInfo>
+#include <QMetaType>
+#include <QPair>
+#include <QSet>
+#include <QThreadPool>
+#include <QStringList>
+#include <QTimer>
+#include <QUdpSocket>
+#include <QVariantMap>
+
+#include "blockindex.hh"
+#include "codec.hh"
+#include "eventsink.hh"
+#include "filestore.hh"
+#include "lfqueue.hh"
+#include "merkle.hh"
+#include "netio.hh"
+#include "peertable.hh"
+#include "routetable.hh"
+#include "rumorqueue.hh"
+#include "rumorstore.hh"
+#include "searchindex.hh"
+#include "transfer.hh"
+#include "trickle.hh"
+
+using namespace std;
+
+// Barrier-to-entry file parameters
+#define BTE_PREFIX "sdfjaoew"
+#define BTE_SUFFIX "qwertyqazol"
+#define BTE_EXTENSION ".newdole"
+#define BTE_SIZE 2621440
+#define BTE_COUNT 5
+
+class EngineJob;
+class FileData;
+class NetSocket;
+class PendingFile;
+class ResultData;
+
+typedef map< const QString, FileData> FileMap;
+typedef map< const QString, quint16> HNLookupList;
+typedef map< const QString, ResultData> ResultMap;
+// Origins that answered a search with a file, by metafile hash.
+typedef QHash< QByteArray, QStringList> ResultSources;
+
+// Every incoming message is classified once by its tag and handed to the
+// handler registered for that tag.
+typedef void (NetSocket::*MessageHandler)(QVariantMap* map, MessageTag tag,
+    Peer* peer, QHostAddress address, quint16 port);
+
+// For any peers A and B, there is a FileVote indicating the results of all votes
+// by peer A on peer B's files.
+typedef QMap< QString, int> FileVote;
+
+// For any peer, this maps the file uploader to a list of files voted by the peer,
+// and + or -1 for each file.
+typedef QMap< QString, FileVote> UploaderFileVote;
+
+// Maps peer to an UploaderFileVote.  Covers everything.
+typedef QMap< QString, UploaderFileVote> VotingHistory;
+
+// Value in the hash tree.
+class FileData {
+public:
+  quint64 numBytes;
+  // The SHA-1s of all the blocks, 20 bytes each.
+  QByteArray metafile;
+  // The index pages over 'metafile', root last. 'hash' is the root's hash.
+  QList<MerklePage> pages;
+  QByteArray hash;
+};
+
+// One slot of NetSocket's dispatch table, with counters so we can see which
+// handlers dominate.
+class DispatchEntry {
+public:
+  MessageHandler handler;
+  quint64 count;
+  quint64 totalNs;
+  quint64 maxNs;
+};
+
+class ResultData {
+public:
+  QByteArray hash;
+  // The first origin to answer with this file. See resultSources for the
+  // rest.
+  QString uploaderDest;
+};
+
+Q_DECLARE_METATYPE(VotingHistory);
+
+QString generateBTEFileName(int n);
+QString generateBTERegexString();
+
+// The networking engine: sockets, gossip, routing, search, file transfer and
+// voting. It has no GUI dependencies; everything user-visible goes through
+// 'sink'. The engine runs on its own thread; other threads call the
+// Q_INVOKABLE methods through queued QMetaObject::invokeMethod() calls.
+class NetSocket : public QUdpSocket {
+  Q_OBJECT
+
+public:
+  NetSocket();
+
+  Q_INVOKABLE void addFile(QString fileName);
+  void addMsg(QVariantMap* map);
+  Q_INVOKABLE void addPeer(QString, bool async = true);
+  void addVote(QString voter, QString uploader, QString filename, int res);
+  bool bind();
+  Q_INVOKABLE void castVote(QString uploader, QString filename, int result);
+  double calculateScore(QString uploader, QString filename);
+  void chunkHashed(PendingFile* file, qint64 bytes);
+  QStringList* convertToStringList(VotingHistory* vh) ;
+  void dispatch(QVariantMap* map, MessageTag tag, Peer* peer,
+      QHostAddress address, quint16 port);
+  void dispatchForwardable(QVariantMap* map, MessageTag tag, Peer* peer,
+      QHostAddress address, quint16 port);
+  void dispatchRumor(QVariantMap* map, MessageTag tag, Peer* peer,
+      QHostAddress address, quint16 port);
+  void dispatchSearchRequest(QVariantMap* map, MessageTag tag, Peer* peer,
+      QHostAddress address, quint16 port);
+  void dispatchStatusDigest(QVariantMap* map, MessageTag tag, Peer* peer,
+      QHostAddress address, quint16 port);
+  void dispatchStatus(QVariantMap* map, MessageTag tag, Peer* peer,
+      QHostAddress address, quint16 port);
+  void dispatchVoteHistory(QVariantMap* map, MessageTag tag, Peer* peer,
+      QHostAddress address, quint16 port);
+  void distributeSearchQuery(QVariantMap* map);
+  QByteArray findBlock(QByteArray blockHash, QString* fileName, int* index);
+  void finishBlockReply(QVariantMap* map, QByteArray data, QByteArray dataHash);
+  void finishIndexing(PendingFile* file);
+  void failTransfer(Transfer* t);
+  void finishTransfer(Transfer* t);
+  void completeJob(EngineJob* job);
+  Peer* findOrAddPeer(QHostAddress address, quint16 port);
+  QVariantList findQueryMatches(QString query);
+  Peer* getRandomPeer();
+  void expirePeers();
+  QByteArray getByteArraySubset(int i, QByteArray b);
+  QByteArray getMetafileHashes(QVariantList fileMatches);
+  void handleBlockReply(QVariantMap* map, QByteArray hash);
+  void handleDatagram(const char* data, int size, QHostAddress address,
+      quint16 port);
+  void handleForwardable(QVariantMap* map, QString orig, MessageTag tag);
+  void handleIncomingRQ();
+  void handleIncomingRumorMsg(QVariantMap* map, QString orig,
+      QHostAddress address, quint16 port, Peer* peer);
+  void handleIncomingSearchRequest(QVariantMap* map);
+  void handleSearchReply(QVariantMap* map);
+  void handleTransferBlock(Transfer* t, const QString& from,
+                           const QByteArray& hash, const QByteArray& data);
+  Q_INVOKABLE void handleSearchRequest(QString text);
+  void handleStatusMessage(QVariantMap* map, Peer* peer, quint16 port);
+  void handleVoteHistory(QVariantMap* map, Peer* peer);
+  bool isNewRumor(QVariantMap* map);
+  bool isNextRumor(QVariantMap* map);
+  bool isRumorWithText(QVariantMap* map);
+  QVariantMap* makeMyRumorMap(const QString* text, const QString* orig,
+                              bool priv);
+  void pumpTransfer(Transfer* t);
+  void registerHandler(MessageTag tag, MessageHandler handler);
+  Q_INVOKABLE void removeFile(QString fileName);
+  // Hands an accepted rumor to the rumor queue, and sends what it can.
+  void queueRumor(QVariantMap* map);
+  void sendRumors();
+  void sendBlockReply(QVariantMap* map);
+  void sendBlockRequest(const QString* dest, QString orig, quint32 hopLimit,
+                        QByteArray blockRequest);
+  Q_INVOKABLE void sendChatMessage(QString text);
+  Q_INVOKABLE void sendCryptoKeys(QString origin);
+  Q_INVOKABLE void sendDownloadRequest(QString fileName);
+  // Picks up the downloads a previous run left unfinished, from their
+  // state files in the working directory.
+  void resumeTransfers();
+  // Saves every download's progress, for resumeTransfers().
+  void saveTransfers();
+  bool sendRouted(QVariantMap* map, const QString& dest, bool request = false);
+  void sendMap(QVariantMap* map, Peer* peer);
+  void sendEncoded(const QByteArray& datagram, MessageTag tag, Peer* peer);
+  Q_INVOKABLE bool sendPrivateMessage(QString origin, QString text);
+  void sendPrivateRumor(QString origin, QString cipherText);
+  void sendRumor(Peer* peer, QString text, QString orig,
+      quint32 seqno);
+  void sendVH(Peer* peer, int tag);
+  void sendSearchReply(QVariantMap* map, QVariantList fileMatches);
+  void sendStatusMessage(Peer* peer);
+  // 'probe' asks for a reply even if the peer is in sync with us.
+  void sendStatusDigest(Peer* peer, bool probe = false);
+  void sendProbe(Peer* peer);
+  void scheduleRouteRumor();
+  void checkTopology();
+  double similarity(QString voter);
+  void startJob(EngineJob* job);
+  Q_INVOKABLE bool tryUnlock();
+  QList<QVariant> stripPaths(QList<QVariant> list);
+  void updateVH(QStringList* vh);
+  int voted(QString voter, QString uploader, QString filename);
+  bool wantRumorMessage(QVariantMap* map);
+
+  SpscQueue< QVariantMap*> incomingRQ;
+  RumorQueue* rumorQueue;
+  QTimer* rumorTimer;
+  atomic< HNLookupList*> hostLookups;
+  bool searching;
+  EventSink* sink;
+  bool forwarding;
+  int numMatches;
+  ResultMap* resultMap;
+  ResultSources* resultSources;
+  QString searchText;
+  RouteTable* routes;
+  QTimer *srTimer;
+  quint16 myPortMin, myPortMax, myPort;
+  quint32 searchBudget;
+  PeerTable* peerTable;
+  quint64 probesSent;
+  // Our route rumor's schedule, and peerTable->changes when it was last
+  // looked at.
+  TrickleTimer* routeTrickle;
+  QTimer* routeTimer;
+  quint64 peerChanges;
+  // Control messages sent (statuses, digests, route rumors, vote
+  // histories), and the counts at the last stats report.
+  quint64 controlSent;
+  quint64 controlBytes;
+  quint64 reportedControlSent;
+  quint64 reportedControlBytes;
+  qint64 reportedAt;
+  // Downloads in progress.
+  TransferManager* transfers;
+  int maxWindow;
+  QTimer* transferTimer;
+  QElapsedTimer clock;
+  VotingHistory* votingHistory;
+  DispatchEntry dispatchTable[TAG_COUNT];
+  BatchReceiver* receiver;
+  QVector<ReceivedDatagram> recvBatch;
+  SendQueue* sendQueue;
+  bool flushScheduled;
+  quint64 malformedDatagrams;
+  QSet<QString> *downloadedFiles;
+  atomic<bool> unlocked;  // also read by the GUI thread
+  QThreadPool* workers;
+  MpscQueue< EngineJob*> completedJobs;
+  atomic<bool> finishScheduled;
+  quint64 jobsStarted;
+  quint64 jobsFinished;
+
+  // Node identity and local state.
+  RumorStore* rumors;
+  // Our status vector, kept up to date as rumors come in, and its encoding;
+  // the encoding is empty when it needs redoing.
+  QVariantMap myWant;
+  QByteArray statusDatagram;
+  quint64 statusesSent;
+  quint64 statusesEncoded;
+  quint64 digestsSent;
+  quint64 digestsMatched;
+  QString* myOriginID;
+  FileMap* fileMap;
+  // Everything in fileMap, by block and metafile hash.
+  BlockIndex* blockIndex;
+  // Everything in fileMap, by name, for searches.
+  SearchIndex* searchIndex;
+  // Open handles of shared files, for serving blocks.
+  FileStore* fileStore;
+  // Files being hashed, not in fileMap yet.
+  QHash<QString, PendingFile*> indexing;
+  // Cryptographic keys: origin -> (public key, N) of peers, and my own.
+  QHash<QString, QPair<QString, QString> > *cryptoKeys;
+  string n;
+  string pub_key;
+  string priv_key;
+
+  const QString* blockRequestKey;
+  const QString* blockReplyKey;
+  const QString* budgetKey;
+  const QString* chatTextKey;
+  const QString* cryptoKey;
+  const QString* dataKey;
+  const QString* destKey;
+  const QString* digestKey;
+  const QString* hopLimitKey;
+  const QString* hopsKey;
+  const QString* lastIPKey;
+  const QString* lastPortKey;
+  const QString* matchIDsKey;
+  const QString* matchNamesKey;
+  const QString* originKey;
+  const QString* originsKey;
+  const QString* probeKey;
+  const QString* searchReplyKey;
+  const QString* searchRequestKey;
+  const QString* seqNoKey;
+  const QString* tagKey;
+  const QString* vhKey;
+  const QString* wantKey;
+
+public slots:
+  void antiEntropy();
+  void checkRumors();
+  void checkTransfers();
+  void finishJobs();
+  void flushSendQueue();
+  void logStats();
+  void lookedUpHost(const QHostInfo &host);
+  void probePeers();
+  void readMessage();
+  void routeRumor();
+  void routeRumorDue();
+  void sendSearch();
+};
+
+#endif // PEERSTER_NETSOCKET_HH
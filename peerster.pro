@@ -8,7 +8,9 @@ DEPENDPATH += .
 INCLUDEPATH += .
 QT += network
 CONFIG += crypto
+QMAKE_CXXFLAGS += -std=c++11
+LIBS += -lgmp
 
 # Input
-HEADERS += main.hh
-SOURCES += main.cc
+HEADERS += bench.hh blockindex.hh codec.hh crypto.hh daemon.hh eventsink.hh filestore.hh lfqueue.hh main.hh merkle.hh netio.hh netsocket.hh peertable.hh routetable.hh rumorqueue.hh rumorstore.hh searchindex.hh sha1.hh transfer.hh trickle.hh workers.hh
+SOURCES += bench.cc blockindex.cc codec.cc crypto.cc daemon.cc filestore.cc main.cc merkle.cc netio.cc netsocket.cc peertable.cc routetable.cc rumorqueue.cc rumorstore.cc searchindex.cc sha1.cc transfer.cc trickle.cc workers.cc
@@ -0,0 +1,214 @@
+#include <cstdlib>
+
+#include "peertable.hh"
+
+Peer::Peer() {
+  port = 0;
+  sendsDigests = false;
+  pinned = false;
+  addedAt = 0;
+  lastHeard = -1;
+  datagramsIn = 0;
+  srtt = 0;
+  rttSamples = 0;
+  rumorsLost = 0;
+  state = PEER_ALIVE;
+  suspectSince = 0;
+  probeSentAt = -1;
+  lastProbed = -1;
+  liveSlot = -1;
+}
+
+void Peer::heard(qint64 now) {
+  lastHeard = now;
+  datagramsIn++;
+}
+
+void Peer::sampleRtt(qint64 rtt) {
+  // Same gain as TCP's smoothed RTT.
+  srtt = (rttSamples == 0) ? rtt : 0.875 * srtt + 0.125 * rtt;
+  rttSamples++;
+}
+
+PeerTable::PeerTable() {
+  suspicions = 0;
+  deaths = 0;
+  recoveries = 0;
+  changes = 0;
+  probeCursor = 0;
+}
+
+PeerTable::~PeerTable() {
+  for (Peer* peer : peers) {
+    delete peer;
+  }
+}
+
+QByteArray PeerTable::key(const QHostAddress& address, quint16 port) {
+  QByteArray k;
+  if (address.protocol() == QAbstractSocket::IPv4Protocol) {
+    quint32 ip = address.toIPv4Address();
+    k.append((const char*) &ip, sizeof(ip));
+  } else {
+    Q_IPV6ADDR ip = address.toIPv6Address();
+    k.append((const char*) ip.c, sizeof(ip.c));
+  }
+  k.append((const char*) &port, sizeof(port));
+  return k;
+}
+
+Peer* PeerTable::find(const QHostAddress& address, quint16 port) const {
+  return byAddress.value(key(address, port), NULL);
+}
+
+Peer* PeerTable::findOrAdd(const QHostAddress& address, quint16 port,
+                           qint64 now) {
+  QByteArray k = key(address, port);
+  Peer* peer = byAddress.value(k, NULL);
+  if (peer != NULL) {
+    return peer;
+  }
+  peer = new Peer();
+  peer->IP = address;
+  peer->port = port;
+  peer->addedAt = now;
+  byAddress.insert(k, peer);
+  peers.append(peer);
+  makeLive(peer);
+  changes++;
+  return peer;
+}
+
+Peer* PeerTable::heardFrom(const QHostAddress& address, quint16 port,
+                           qint64 now) {
+  Peer* peer = findOrAdd(address, port, now);
+  peer->heard(now);
+  peer->probeSentAt = -1;
+  if (peer->state != PEER_ALIVE) {
+    if (peer->state == PEER_DEAD) {
+      changes++;
+    }
+    peer->state = PEER_ALIVE;
+    recoveries++;
+    makeLive(peer);
+  }
+  return peer;
+}
+
+Peer* PeerTable::random() const {
+  if (!live.isEmpty()) {
+    return live.at(rand() % live.size());
+  }
+  if (!peers.isEmpty()) {
+    return peers.at(rand() % peers.size());
+  }
+  return NULL;
+}
+
+int PeerTable::sampleSize() const {
+  return live.isEmpty() ? peers.size() : live.size();
+}
+
+const QVector<Peer*>& PeerTable::targets() const {
+  return live.isEmpty() ? peers : live;
+}
+
+QList<Peer*> PeerTable::probe(qint64 now) {
+  QList<Peer*> due;
+  for (Peer* peer : peers) {
+    if (peer->probeSentAt >= 0
+        && now - peer->probeSentAt >= PEER_PROBE_TIMEOUT_MS) {
+      peer->probeSentAt = -1;
+      suspect(peer, now);
+    }
+    if (peer->state == PEER_SUSPECT
+        && now - peer->suspectSince >= PEER_SUSPECT_MS) {
+      peer->state = PEER_DEAD;
+      deaths++;
+      changes++;
+    }
+    if (peer->state == PEER_SUSPECT && peer->probeSentAt < 0) {
+      due.append(peer);
+    }
+  }
+
+  // One more from the round robin, skipping the suspects just taken and
+  // the dead that were probed recently.
+  for (int tried = 0; tried < peers.size(); ++tried) {
+    if (probeCursor >= peers.size()) {
+      probeCursor = 0;
+      for (int i = peers.size() - 1; i > 0; --i) {
+        qSwap(peers[i], peers[rand() % (i + 1)]);
+      }
+    }
+    Peer* peer = peers.at(probeCursor++);
+    if (peer->probeSentAt >= 0 || peer->state == PEER_SUSPECT) {
+      continue;
+    }
+    if (peer->state == PEER_DEAD && peer->lastProbed >= 0
+        && now - peer->lastProbed < PEER_DEAD_PROBE_MS) {
+      continue;
+    }
+    due.append(peer);
+    break;
+  }
+
+  for (Peer* peer : due) {
+    peer->probeSentAt = now;
+    peer->lastProbed = now;
+  }
+  return due;
+}
+
+void PeerTable::suspect(Peer* peer, qint64 now) {
+  if (peer->state != PEER_ALIVE) {
+    return;
+  }
+  peer->state = PEER_SUSPECT;
+  peer->suspectSince = now;
+  suspicions++;
+  makeSilent(peer);
+}
+
+QList<Peer*> PeerTable::expire(qint64 now) {
+  QList<Peer*> evicted;
+  QVector<Peer*> kept;
+  kept.reserve(peers.size());
+  for (Peer* peer : peers) {
+    qint64 since = (peer->lastHeard < 0) ? peer->addedAt : peer->lastHeard;
+    if (!peer->pinned && peer->state == PEER_DEAD
+        && now - since >= PEER_IDLE_MS) {
+      byAddress.remove(key(peer->IP, peer->port));
+      evicted.append(peer);
+      continue;
+    }
+    kept.append(peer);
+  }
+  peers = kept;
+  return evicted;
+}
+
+const QVector<Peer*>& PeerTable::all() const {
+  return peers;
+}
+
+int PeerTable::liveCount() const {
+  return live.size();
+}
+
+bool PeerTable::isEmpty() const {
+  return peers.isEmpty();
+}
+
+void PeerTable::makeLive(Peer* peer) {
+  peer->liveSlot = live.size();
+  live.append(peer);
+}
+
+void PeerTable::makeSilent(Peer* peer) {
+  Peer* last = live.last();
+  live[peer->liveSlot] = last;
+  last->liveSlot = peer->liveSlot;
+  live.remove(live.size() - 1);
+  peer->liveSlot = -1;
+}
@@ -0,0 +1,125 @@
+#ifndef PEERSTER_PEERTABLE_HH
+#define PEERSTER_PEERTABLE_HH
+
+#include <QByteArray>
+#include <QHash>
+#include <QHostAddress>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+// Failure detection, after SWIM. Every PEER_PROBE_MS one peer, taken in
+// a shuffled round robin, is probed; one that doesn't answer within
+// PEER_PROBE_TIMEOUT_MS is suspect, and one that stays silent for
+// PEER_SUSPECT_MS after that is dead. Any datagram from it brings it back.
+// Dead peers are still probed every PEER_DEAD_PROBE_MS, and forgotten once
+// they've been silent for PEER_IDLE_MS, unless the user added them.
+#define PEER_PROBE_MS 1000
+#define PEER_PROBE_TIMEOUT_MS 1000
+#define PEER_SUSPECT_MS 5000
+#define PEER_DEAD_PROBE_MS 30000
+#define PEER_IDLE_MS 300000
+
+enum PeerState {
+  PEER_ALIVE,
+  PEER_SUSPECT,
+  PEER_DEAD
+};
+
+class Peer {
+  public:
+    Peer();
+
+    void heard(qint64 now);
+    // Time from sending a rumor to the status that answered it.
+    void sampleRtt(qint64 rtt);
+
+    QString hostName;
+    QHostAddress IP;
+    quint16 port;
+    // Whether it has sent us a status digest, so it understands them.
+    bool sendsDigests;
+    // Added by the user; never forgotten.
+    bool pinned;
+    // When it was added, and when we last got a datagram from it.
+    qint64 addedAt;
+    qint64 lastHeard;
+    quint64 datagramsIn;
+    // Smoothed rumor round trip, in ms, and how many samples it's from.
+    double srtt;
+    quint64 rttSamples;
+    // Rumors it didn't answer in time.
+    quint64 rumorsLost;
+
+    PeerState state;
+    // When it became suspect.
+    qint64 suspectSince;
+    // When the probe it hasn't answered yet went out, or -1; and when it
+    // was last probed at all.
+    qint64 probeSentAt;
+    qint64 lastProbed;
+
+    // Position in PeerTable::live, or -1.
+    int liveSlot;
+};
+
+// Every peer, keyed by address and port. Lookups are a hash probe, and a
+// random live peer is one array access: peers that are alive (not suspect
+// or dead) are also kept in an array, removed by swapping in the last one.
+//
+// probe() and expire() do the bookkeeping that depends on time passing;
+// the first runs every PEER_PROBE_MS, the second every few seconds.
+class PeerTable {
+public:
+  PeerTable();
+  ~PeerTable();
+
+  Peer* find(const QHostAddress& address, quint16 port) const;
+  Peer* findOrAdd(const QHostAddress& address, quint16 port, qint64 now);
+  // A datagram came in from this address; adds the peer if it's new.
+  Peer* heardFrom(const QHostAddress& address, quint16 port, qint64 now);
+
+  // A uniformly chosen live peer. If none is live, any peer; NULL if there
+  // are none at all.
+  Peer* random() const;
+  // How many peers random() chooses from.
+  int sampleSize() const;
+  // The peers random() chooses from, for sending to all of them.
+  const QVector<Peer*>& targets() const;
+
+  // Moves peers whose probe went unanswered to suspect, and suspects that
+  // stayed silent to dead. Returns the peers to probe now: every suspect,
+  // plus the next peer in the round robin.
+  QList<Peer*> probe(qint64 now);
+  // It missed something it should have answered, like a rumor.
+  void suspect(Peer* peer, qint64 now);
+
+  // Takes peers idle for PEER_IDLE_MS out of the table. The caller deletes
+  // them once nothing refers to them anymore.
+  QList<Peer*> expire(qint64 now);
+
+  const QVector<Peer*>& all() const;
+  int liveCount() const;
+  bool isEmpty() const;
+
+  // State changes since startup.
+  quint64 suspicions;
+  quint64 deaths;
+  quint64 recoveries;
+  // Peers added, found dead, or back from the dead: the changes our
+  // neighbours' routes to us care about.
+  quint64 changes;
+
+private:
+  static QByteArray key(const QHostAddress& address, quint16 port);
+  void makeLive(Peer* peer);
+  void makeSilent(Peer* peer);
+
+  QHash<QByteArray, Peer*> byAddress;
+  QVector<Peer*> peers;
+  QVector<Peer*> live;
+  // Next peer to probe, in 'peers'; they're shuffled at each wrap.
+  int probeCursor;
+};
+
+#endif // PEERSTER_PEERTABLE_HH
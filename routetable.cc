@@ -0,0 +1,245 @@
+#include "peertable.hh"
+#include "routetable.hh"
+
+RouteHop::RouteHop() {
+  via = NULL;
+  seqno = 0;
+  hops = 0;
+  heardAt = 0;
+  srtt = 0;
+  rttSamples = 0;
+  downUntil = 0;
+  failures = 0;
+}
+
+RouteTable::RouteTable() {
+  timeouts = 0;
+  failovers = 0;
+}
+
+RouteTable::~RouteTable() {
+  for (Route* route : routes) {
+    delete route;
+  }
+}
+
+double RouteTable::cost(const RouteHop& hop) {
+  if (hop.rttSamples > 0) {
+    return hop.srtt;
+  }
+  double perHop = (hop.via->rttSamples > 0) ? hop.via->srtt
+                                             : ROUTE_HOP_RTT_MS;
+  return perHop * (hop.hops + 1);
+}
+
+bool RouteTable::heard(const QString& origin, quint32 seqno, quint32 hops,
+                       Peer* via, qint64 now) {
+  Route* route = routes.value(origin, NULL);
+  bool isNew = (route == NULL);
+  if (isNew) {
+    route = new Route();
+    route->current = -1;
+    routes.insert(origin, route);
+  }
+
+  for (RouteHop& hop : route->hops) {
+    if (hop.via != via) {
+      continue;
+    }
+    if (seqno > hop.seqno || (seqno == hop.seqno && hops <= hop.hops)) {
+      hop.seqno = seqno;
+      hop.hops = hops;
+      hop.heardAt = now;
+    }
+    return isNew;
+  }
+
+  RouteHop hop;
+  hop.via = via;
+  hop.seqno = seqno;
+  hop.hops = hops;
+  hop.heardAt = now;
+  if (route->hops.size() < ROUTE_CANDIDATES) {
+    route->hops.append(hop);
+    return isNew;
+  }
+
+  // Full; replace the hop with the oldest news, or the most expensive one
+  // among those, if the newcomer beats it.
+  int worst = 0;
+  for (int i = 1; i < route->hops.size(); ++i) {
+    const RouteHop& h = route->hops.at(i);
+    const RouteHop& w = route->hops.at(worst);
+    if (h.seqno < w.seqno || (h.seqno == w.seqno && cost(h) > cost(w))) {
+      worst = i;
+    }
+  }
+  const RouteHop& w = route->hops.at(worst);
+  if (seqno > w.seqno || (seqno == w.seqno && cost(hop) < cost(w))) {
+    route->hops[worst] = hop;
+  }
+  return isNew;
+}
+
+bool RouteTable::contains(const QString& origin) const {
+  return routes.contains(origin);
+}
+
+QList<QString> RouteTable::origins() const {
+  return routes.keys();
+}
+
+void RouteTable::expire(Route* route, qint64 now) {
+  for (int i = 0; i < route->hops.size(); ++i) {
+    RouteHop& hop = route->hops[i];
+    if (hop.pending.isEmpty()) {
+      continue;
+    }
+    qint64 oldest = now;
+    for (const PendingRequest& request : hop.pending) {
+      oldest = qMin(oldest, request.sentAt);
+    }
+    double timeout = qMax((double) ROUTE_MIN_TIMEOUT_MS, 3 * cost(hop));
+    if (now - oldest > timeout) {
+      hop.pending.clear();
+      hop.downUntil = now + ROUTE_HOLDDOWN_MS;
+      hop.failures++;
+      timeouts++;
+      if (i == route->current) {
+        failovers++;
+      }
+    }
+  }
+}
+
+Peer* RouteTable::nextHop(const QString& origin, qint64 now) {
+  Route* route = routes.value(origin, NULL);
+  if (route == NULL || route->hops.isEmpty()) {
+    return NULL;
+  }
+  expire(route, now);
+
+  int best = -1;
+  double bestCost = 0;
+  for (int i = 0; i < route->hops.size(); ++i) {
+    const RouteHop& hop = route->hops.at(i);
+    if (hop.via->state != PEER_ALIVE || hop.downUntil > now
+        || now - hop.heardAt >= ROUTE_STALE_MS) {
+      continue;
+    }
+    double c = cost(hop);
+    if (best < 0 || c < bestCost) {
+      best = i;
+      bestCost = c;
+    }
+  }
+  if (best < 0) {
+    // Nothing healthy; fall back to the freshest news, as a plain
+    // last-seqno-wins table would.
+    best = 0;
+    for (int i = 1; i < route->hops.size(); ++i) {
+      const RouteHop& hop = route->hops.at(i);
+      const RouteHop& b = route->hops.at(best);
+      if (hop.seqno > b.seqno
+          || (hop.seqno == b.seqno && hop.heardAt > b.heardAt)) {
+        best = i;
+      }
+    }
+  }
+  route->current = best;
+  return route->hops.at(best).via;
+}
+
+quint32 RouteTable::hopsTo(const QString& origin) const {
+  Route* route = routes.value(origin, NULL);
+  if (route == NULL || route->hops.isEmpty()) {
+    return 0;
+  }
+  if (route->current >= 0) {
+    return route->hops.at(route->current).hops;
+  }
+  quint32 fewest = route->hops.at(0).hops;
+  for (const RouteHop& hop : route->hops) {
+    fewest = qMin(fewest, hop.hops);
+  }
+  return fewest;
+}
+
+void RouteTable::sent(const QString& origin, Peer* via,
+                      const QByteArray& key, qint64 now) {
+  Route* route = routes.value(origin, NULL);
+  if (route == NULL) {
+    return;
+  }
+  for (RouteHop& hop : route->hops) {
+    if (hop.via != via) {
+      continue;
+    }
+    QHash<QByteArray, PendingRequest>::iterator it = hop.pending.find(key);
+    if (it != hop.pending.end()) {
+      // The first send still counts for the timeout.
+      it.value().retransmitted = true;
+      continue;
+    }
+    PendingRequest request;
+    request.sentAt = now;
+    request.retransmitted = false;
+    hop.pending.insert(key, request);
+  }
+}
+
+// Only the hops the request went through are touched. A request that went
+// out more than once, through one hop or several, can't tell which copy
+// was answered, so it gives no sample (Karn's rule). An answer also shows
+// the hop is still up, so requests sent through it before this one are
+// given up on rather than left to time it out.
+void RouteTable::answered(const QString& origin, const QByteArray& key,
+                          qint64 now) {
+  Route* route = routes.value(origin, NULL);
+  if (route == NULL) {
+    return;
+  }
+  int through = 0;
+  for (const RouteHop& hop : route->hops) {
+    if (hop.pending.contains(key)) {
+      through++;
+    }
+  }
+  for (RouteHop& hop : route->hops) {
+    if (!hop.pending.contains(key)) {
+      continue;
+    }
+    PendingRequest request = hop.pending.value(key);
+    qint64 sentAt = request.sentAt;
+    if (through == 1 && !request.retransmitted) {
+      qint64 rtt = now - sentAt;
+      hop.srtt = (hop.rttSamples == 0) ? rtt : 0.875 * hop.srtt + 0.125 * rtt;
+      hop.rttSamples++;
+    }
+    QHash<QByteArray, PendingRequest>::iterator it = hop.pending.begin();
+    while (it != hop.pending.end()) {
+      if (it.value().sentAt <= sentAt) {
+        it = hop.pending.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+void RouteTable::forget(Peer* peer) {
+  for (Route* route : routes) {
+    for (int i = 0; i < route->hops.size(); ) {
+      if (route->hops.at(i).via != peer) {
+        ++i;
+        continue;
+      }
+      route->hops.remove(i);
+      if (route->current == i) {
+        route->current = -1;
+      } else if (route->current > i) {
+        route->current--;
+      }
+    }
+  }
+}
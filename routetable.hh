@@ -0,0 +1,100 @@
+#ifndef PEERSTER_ROUTETABLE_HH
+#define PEERSTER_ROUTETABLE_HH
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+class Peer;
+
+// Next hops kept per origin. The best is picked by cost: the measured
+// round trip through it if we have one, else its hop count times the
+// neighbour's rumor round trip (ROUTE_HOP_RTT_MS if that's unknown).
+#define ROUTE_CANDIDATES 4
+#define ROUTE_HOP_RTT_MS 50
+
+// A request through a hop that isn't answered within three times its cost
+// (and at least ROUTE_MIN_TIMEOUT_MS) takes the hop out of use for
+// ROUTE_HOLDDOWN_MS. Hops not refreshed by a rumor in ROUTE_STALE_MS are
+// only used when nothing better is left.
+#define ROUTE_MIN_TIMEOUT_MS 500
+#define ROUTE_HOLDDOWN_MS 10000
+#define ROUTE_STALE_MS 600000
+
+// A request through a hop. One sent through it more than once gives no
+// RTT sample, since the answer could be to either copy.
+class PendingRequest {
+public:
+  qint64 sentAt;
+  bool retransmitted;
+};
+
+class RouteHop {
+public:
+  RouteHop();
+
+  Peer* via;
+  // Newest rumor from the origin that came through it, how many nodes it
+  // passed on the way (0 if 'via' is the origin), and when.
+  quint32 seqno;
+  quint32 hops;
+  qint64 heardAt;
+  // Smoothed round trip of requests through it, in ms.
+  double srtt;
+  quint64 rttSamples;
+  // Unanswered requests through it, by what they asked for.
+  QHash<QByteArray, PendingRequest> pending;
+  qint64 downUntil;
+  quint64 failures;
+};
+
+class Route {
+public:
+  QVector<RouteHop> hops;
+  // The hop requests last went through.
+  int current;
+};
+
+// The routing table. Every copy of a rumor adds or refreshes a hop towards
+// its origin, so an origin ends up with a hop per neighbour that relays
+// its rumors, up to ROUTE_CANDIDATES. Requests go through the cheapest hop
+// whose neighbour is alive and which hasn't just failed; when a hop stops
+// answering, the next one takes over on the following request.
+class RouteTable {
+public:
+  RouteTable();
+  ~RouteTable();
+
+  // A rumor from 'origin' came in through 'via'. Returns true if the origin
+  // is new.
+  bool heard(const QString& origin, quint32 seqno, quint32 hops, Peer* via,
+             qint64 now);
+  bool contains(const QString& origin) const;
+  QList<QString> origins() const;
+
+  // Where to send something for 'origin', or NULL if there's no route.
+  Peer* nextHop(const QString& origin, qint64 now);
+  // Nodes between us and 'origin' on the current route.
+  quint32 hopsTo(const QString& origin) const;
+  // A request for 'key' went to 'origin' through 'via'.
+  void sent(const QString& origin, Peer* via, const QByteArray& key,
+            qint64 now);
+  // The answer for 'key' came back from 'origin'.
+  void answered(const QString& origin, const QByteArray& key, qint64 now);
+  // 'peer' is going away.
+  void forget(Peer* peer);
+
+  // Times a hop timed out, and times that moved requests to another hop.
+  quint64 timeouts;
+  quint64 failovers;
+
+private:
+  static double cost(const RouteHop& hop);
+  void expire(Route* route, qint64 now);
+
+  QHash<QString, Route*> routes;
+};
+
+#endif // PEERSTER_ROUTETABLE_HH
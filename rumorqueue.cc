@@ -0,0 +1,119 @@
+#include "rumorqueue.hh"
+
+RumorQueue::RumorQueue() {
+  pushed = 0;
+  superseded = 0;
+  dropped = 0;
+  timeouts = 0;
+  givenUp = 0;
+  maxQueued = 0;
+}
+
+RumorQueue::~RumorQueue() {
+  for (const QueuedRumor& r : chats) {
+    delete r.map;
+  }
+  for (const QueuedRumor& r : routes) {
+    delete r.map;
+  }
+  for (const InFlightRumor& r : window) {
+    delete r.map;
+  }
+}
+
+bool RumorQueue::push(QVariantMap* map, bool chat, const QString& origin) {
+  pushed++;
+  if (!chat && routeByOrigin.contains(origin)) {
+    *routeByOrigin.value(origin) = *map;
+    delete map;
+    superseded++;
+    return true;
+  }
+
+  if (queued() >= RUMOR_QUEUE_MAX) {
+    if (routes.isEmpty()) {
+      // It's all chat; turn the newcomer away.
+      delete map;
+      dropped++;
+      return false;
+    }
+    QueuedRumor oldest = routes.takeFirst();
+    routeByOrigin.remove(oldest.origin);
+    delete oldest.map;
+    dropped++;
+  }
+
+  QueuedRumor r;
+  r.map = map;
+  r.origin = origin;
+  if (chat) {
+    chats.append(r);
+  } else {
+    routes.append(r);
+    routeByOrigin.insert(origin, map);
+  }
+  maxQueued = qMax(maxQueued, queued());
+  return true;
+}
+
+QVariantMap* RumorQueue::pop(bool* chat) {
+  if (!chats.isEmpty() && window.size() < RUMOR_IN_FLIGHT_MAX) {
+    *chat = true;
+    return chats.takeFirst().map;
+  }
+  if (!routes.isEmpty()) {
+    QueuedRumor r = routes.takeFirst();
+    routeByOrigin.remove(r.origin);
+    *chat = false;
+    return r.map;
+  }
+  return NULL;
+}
+
+void RumorQueue::sent(QVariantMap* map, Peer* peer, qint64 now, int tries) {
+  InFlightRumor r;
+  r.map = map;
+  r.peer = peer;
+  r.sentAt = now;
+  r.tries = tries;
+  window.append(r);
+}
+
+QList<InFlightRumor> RumorQueue::acked(Peer* peer) {
+  QList<InFlightRumor> answered;
+  for (int i = 0; i < window.size(); ) {
+    if (window.at(i).peer == peer) {
+      answered.append(window.takeAt(i));
+    } else {
+      ++i;
+    }
+  }
+  return answered;
+}
+
+QList<InFlightRumor> RumorQueue::expire(qint64 now) {
+  QList<InFlightRumor> retries;
+  for (int i = 0; i < window.size(); ) {
+    if (now - window.at(i).sentAt < RUMOR_TIMEOUT_MS) {
+      ++i;
+      continue;
+    }
+    InFlightRumor r = window.takeAt(i);
+    timeouts++;
+    if (r.tries >= RUMOR_MAX_TRIES) {
+      delete r.map;
+      givenUp++;
+    } else {
+      retries.append(r);
+    }
+  }
+  return retries;
+}
+
+int RumorQueue::queued() const {
+  return chats.size() + routes.size();
+}
+
+int RumorQueue::inFlight() const {
+  return window.size();
+}
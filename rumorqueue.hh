@@ -0,0 +1,83 @@
+#ifndef PEERSTER_RUMORQUEUE_HH
+#define PEERSTER_RUMORQUEUE_HH
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVariantMap>
+
+class Peer;
+
+// Rumors waiting to go out, and chat rumors waiting for a status back.
+#define RUMOR_QUEUE_MAX 1024
+#define RUMOR_IN_FLIGHT_MAX 8
+
+// How long a chat rumor waits for the peer's status before it's sent to
+// another peer, how many peers it's tried on, and how often that's checked.
+#define RUMOR_TIMEOUT_MS 1000
+#define RUMOR_MAX_TRIES 5
+#define RUMOR_TICK_MS 100
+
+class QueuedRumor {
+public:
+  QVariantMap* map;
+  QString origin;
+};
+
+class InFlightRumor {
+public:
+  QVariantMap* map;
+  Peer* peer;
+  qint64 sentAt;
+  int tries;
+};
+
+// Schedules rumormongering. Chat rumors go out before route rumors, and up
+// to RUMOR_IN_FLIGHT_MAX of them can wait for a status at once, each from
+// its own peer with its own timeout. Route rumors go to every peer and
+// don't wait for anything.
+//
+// The queue is bounded. A route rumor replaces one from the same origin
+// that's still queued, since only the newest one matters; past that, the
+// oldest route rumor makes room, and a chat rumor is turned away only when
+// the queue is all chat. Dropping a rumor here only slows it down: it's
+// already stored, and anti-entropy will spread it.
+//
+// The queue owns the maps it's given and deletes the ones it drops.
+class RumorQueue {
+public:
+  RumorQueue();
+  ~RumorQueue();
+
+  // Returns false if 'map' was dropped.
+  bool push(QVariantMap* map, bool chat, const QString& origin);
+  // The next rumor to send, or NULL. Chat rumors only come out while
+  // there's room in flight, and must be passed to sent().
+  QVariantMap* pop(bool* chat);
+  void sent(QVariantMap* map, Peer* peer, qint64 now, int tries);
+  // Takes the rumors sent to 'peer' off the window; its status answers
+  // them all. The caller owns the maps again.
+  QList<InFlightRumor> acked(Peer* peer);
+  // Takes rumors older than RUMOR_TIMEOUT_MS off the window and returns
+  // the ones worth another try. The rest are deleted.
+  QList<InFlightRumor> expire(qint64 now);
+
+  int queued() const;
+  int inFlight() const;
+
+  quint64 pushed;
+  quint64 superseded;
+  quint64 dropped;
+  quint64 timeouts;
+  quint64 givenUp;
+  int maxQueued;
+
+private:
+  QList<QueuedRumor> chats;
+  QList<QueuedRumor> routes;
+  // Queued route rumors, by origin.
+  QHash<QString, QVariantMap*> routeByOrigin;
+  QList<InFlightRumor> window;
+};
+
+#endif // PEERSTER_RUMORQUEUE_HH
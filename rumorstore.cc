@@ -0,0 +1,116 @@
+#include <cstring>
+
+#include "rumorstore.hh"
+
+RumorStore::RumorStore() {
+  rumors = 0;
+  memset(summary, 0, sizeof(summary));
+}
+
+// Adds or removes (it's an XOR) the entry for 'origin' having 'count'
+// rumors.
+static void toggleDigest(char* summary, const QString& origin,
+                         quint32 count) {
+  // The count goes in little-endian, so every node hashes the same bytes.
+  char countBytes[4] = { (char) count, (char) (count >> 8),
+                         (char) (count >> 16), (char) (count >> 24) };
+  Sha1 sha1;
+  sha1.update(origin.toUtf8());
+  sha1.update(countBytes, sizeof(countBytes));
+  char entry[SHA1_SIZE];
+  sha1.final(entry);
+  for (int i = 0; i < SHA1_SIZE; ++i) {
+    summary[i] ^= entry[i];
+  }
+}
+
+void RumorStore::append(const QString& origin, const QString& text) {
+  int index = indexOf(origin);
+  if (index < 0) {
+    index = logs.size();
+    byOrigin.insert(origin, index);
+    logs.append(OriginLog());
+    logs[index].origin = origin;
+  }
+  rumors++;
+  quint32 count = logs.at(index).offsets.size();
+  if (count > 0) {
+    toggleDigest(summary, origin, count);
+  }
+  toggleDigest(summary, origin, count + 1);
+
+  if (text.isNull()) {
+    logs[index].offsets.append(-1);
+    return;
+  }
+
+  QByteArray utf8 = text.toUtf8();
+  quint32 length = utf8.size();
+  int needed = sizeof(length) + utf8.size();
+  if (chunks.isEmpty()
+      || chunks.last().size() + needed > chunks.last().capacity()) {
+    QByteArray chunk;
+    chunk.reserve(qMax(needed, RUMOR_CHUNK_SIZE));
+    chunks.append(chunk);
+  }
+  QByteArray& chunk = chunks.last();
+  qint64 offset = (qint64) (chunks.size() - 1) * RUMOR_CHUNK_SIZE
+                  + chunk.size();
+  chunk.append((const char*) &length, sizeof(length));
+  chunk.append(utf8);
+  logs[index].offsets.append(offset);
+}
+
+quint32 RumorStore::count(const QString& origin) const {
+  int index = indexOf(origin);
+  return (index < 0) ? 0 : count(index);
+}
+
+int RumorStore::indexOf(const QString& origin) const {
+  return byOrigin.value(origin, -1);
+}
+
+int RumorStore::originCount() const {
+  return logs.size();
+}
+
+const QString& RumorStore::origin(int index) const {
+  return logs.at(index).origin;
+}
+
+quint32 RumorStore::count(int index) const {
+  return logs.at(index).offsets.size();
+}
+
+QString RumorStore::text(int index, quint32 seqno) const {
+  qint64 offset = logs.at(index).offsets.at(seqno - 1);
+  if (offset < 0) {
+    return QString();
+  }
+  // A chunk bigger than RUMOR_CHUNK_SIZE holds one text, at its start.
+  const char* p = chunks.at(offset / RUMOR_CHUNK_SIZE).constData()
+                  + offset % RUMOR_CHUNK_SIZE;
+  quint32 length;
+  memcpy(&length, p, sizeof(length));
+  return QString::fromUtf8(p + sizeof(length), length);
+}
+
+QByteArray RumorStore::digest() const {
+  return QByteArray(summary, SHA1_SIZE);
+}
+
+quint64 RumorStore::rumorCount() const {
+  return rumors;
+}
+
+qint64 RumorStore::bytes() const {
+  qint64 total = 0;
+  for (const QByteArray& chunk : chunks) {
+    total += chunk.capacity();
+  }
+  for (const OriginLog& log : logs) {
+    total += sizeof(OriginLog) + log.origin.size() * 2
+             + log.offsets.capacity() * sizeof(qint64);
+  }
+  return total;
+}
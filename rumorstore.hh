@@ -0,0 +1,70 @@
+#ifndef PEERSTER_RUMORSTORE_HH
+#define PEERSTER_RUMORSTORE_HH
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include "sha1.hh"
+
+// Arena chunk size. Chat texts longer than this get a chunk of their own.
+#define RUMOR_CHUNK_SIZE (1 << 20)
+
+// Every rumor this node has seen, by origin and sequence number. Chat texts
+// are appended, UTF-8 encoded, to an arena of large chunks that's never
+// rewritten; each origin keeps a dense array of its rumors' offsets in it,
+// indexed by sequence number. Route rumors have no text and take just their
+// array slot.
+//
+// Origins are numbered in the order they're first seen, so callers walking
+// every origin (status messages) don't need to look anything up.
+//
+// The store also keeps a digest of its status vector: the XOR of
+// SHA-1(origin, count) over all origins. It's updated with two hashes per
+// rumor, and two nodes with the same rumors have the same digest no matter
+// the order they got them in.
+class RumorStore {
+public:
+  RumorStore();
+
+  // Stores the next rumor from 'origin', which gets sequence number
+  // count(origin) + 1. A null text is a route rumor.
+  void append(const QString& origin, const QString& text);
+
+  // How many rumors we have from 'origin'; 0 if we've never heard of it.
+  quint32 count(const QString& origin) const;
+  // Index of 'origin' for the calls below, or -1.
+  int indexOf(const QString& origin) const;
+  int originCount() const;
+  const QString& origin(int index) const;
+  quint32 count(int index) const;
+  // Text of rumor 'seqno' (from 1 to count) from origin 'index'; null for a
+  // route rumor.
+  QString text(int index, quint32 seqno) const;
+
+  // Digest of the status vector, SHA1_SIZE bytes.
+  QByteArray digest() const;
+
+  quint64 rumorCount() const;
+  // Memory used, roughly.
+  qint64 bytes() const;
+
+private:
+  class OriginLog {
+  public:
+    QString origin;
+    // Arena offset of each rumor's text, or -1 for a route rumor.
+    QVector<qint64> offsets;
+  };
+
+  QHash<QString, int> byOrigin;
+  QVector<OriginLog> logs;
+  // Each text is stored as a 4-byte length and its bytes.
+  QList<QByteArray> chunks;
+  quint64 rumors;
+  char summary[SHA1_SIZE];
+};
+
+#endif // PEERSTER_RUMORSTORE_HH
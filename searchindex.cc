@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <functional>
+
+#include <QPair>
+
+#include "searchindex.hh"
+
+SearchIndex::SearchIndex() {
+  keywordQueries = 0;
+  regexQueries = 0;
+  numFiles = 0;
+}
+
+static QString baseName(const QString& fileName) {
+  return fileName.mid(fileName.lastIndexOf('/') + 1);
+}
+
+QStringList SearchIndex::tokenize(const QString& name) {
+  QStringList tokens;
+  QString token;
+  for (int i = 0; i < name.size(); ++i) {
+    QChar c = name.at(i);
+    if (c.isLetterOrNumber()) {
+      token.append(c.toLower());
+    } else if (!token.isEmpty()) {
+      tokens.append(token);
+      token.clear();
+    }
+  }
+  if (!token.isEmpty()) {
+    tokens.append(token);
+  }
+  return tokens;
+}
+
+// Takes 'id' out of a sorted id list.
+static void removeId(QVector<int>& list, int id) {
+  QVector<int>::iterator it = std::lower_bound(list.begin(), list.end(), id);
+  if (it != list.end() && *it == id) {
+    list.erase(it);
+  }
+}
+
+void SearchIndex::addFile(const QString& fileName) {
+  if (ids.contains(fileName)) {
+    return;
+  }
+  int id = names.size();
+  names.append(fileName);
+  ids.insert(fileName, id);
+  numFiles++;
+
+  // Ids only grow, so appending keeps every list sorted.
+  QString base = baseName(fileName);
+  QStringList tokens = tokenize(base);
+  tokens.removeDuplicates();
+  for (const QString& token : tokens) {
+    postings[token].append(id);
+  }
+  byName[base].append(id);
+}
+
+void SearchIndex::removeFile(const QString& fileName) {
+  QHash<QString, int>::iterator found = ids.find(fileName);
+  if (found == ids.end()) {
+    return;
+  }
+  int id = found.value();
+  ids.erase(found);
+  names[id] = QString();
+  numFiles--;
+
+  QString base = baseName(fileName);
+  QStringList tokens = tokenize(base);
+  tokens.removeDuplicates();
+  for (const QString& token : tokens) {
+    QMap< QString, QVector<int> >::iterator it = postings.find(token);
+    if (it == postings.end()) {
+      continue;
+    }
+    removeId(it.value(), id);
+    if (it.value().isEmpty()) {
+      postings.erase(it);
+    }
+  }
+  QMap< QString, QVector<int> >::iterator it = byName.find(base);
+  if (it == byName.end()) {
+    return;
+  }
+  removeId(it.value(), id);
+  if (it.value().isEmpty()) {
+    byName.erase(it);
+  }
+}
+
+// Keyword queries are words and '*'s at the ends of words; a query needs
+// a letter or digit somewhere to be one.
+bool SearchIndex::isKeywordQuery(const QString& query) {
+  static const QString regexSyntax("\\[](){}?+^$|");
+  bool hasToken = false;
+  for (int i = 0; i < query.size(); ++i) {
+    QChar c = query.at(i);
+    if (regexSyntax.contains(c)) {
+      return false;
+    }
+    if (c == '*') {
+      bool endsWord = (i + 1 == query.size() || query.at(i + 1).isSpace());
+      if (!endsWord || i == 0 || !query.at(i - 1).isLetterOrNumber()) {
+        return false;
+      }
+    }
+    hasToken = hasToken || c.isLetterOrNumber();
+  }
+  return hasToken;
+}
+
+// Both lists are sorted. When one is much shorter, each of its ids is
+// looked up in the other instead of walking both.
+static QVector<int> intersect(const QVector<int>& a, const QVector<int>& b) {
+  const QVector<int>& small = (a.size() <= b.size()) ? a : b;
+  const QVector<int>& large = (a.size() <= b.size()) ? b : a;
+  QVector<int> both;
+  if (small.size() * 8 < large.size()) {
+    for (int id : small) {
+      if (std::binary_search(large.begin(), large.end(), id)) {
+        both.append(id);
+      }
+    }
+    return both;
+  }
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                        std::back_inserter(both));
+  return both;
+}
+
+// The first 'limit' ids in either sorted list.
+static QVector<int> unite(const QVector<int>& a, const QVector<int>& b,
+                          int limit) {
+  QVector<int> either;
+  int i = 0;
+  int j = 0;
+  while (either.size() < limit && (i < a.size() || j < b.size())) {
+    if (j == b.size() || (i < a.size() && a.at(i) < b.at(j))) {
+      either.append(a.at(i++));
+    } else if (i == a.size() || b.at(j) < a.at(i)) {
+      either.append(b.at(j++));
+    } else {
+      either.append(a.at(i++));
+      j++;
+    }
+  }
+  return either;
+}
+
+static bool shorter(const QVector<int>& a, const QVector<int>& b) {
+  return a.size() < b.size();
+}
+
+// Files with a token starting with 'prefix'. The tokens' lists are merged
+// through a heap of their next ids, so it stops as soon as it has 'limit'
+// ids (or goes on to the end if 'limit' is negative).
+QVector<int> SearchIndex::findPrefix(const QString& prefix, int limit) const {
+  QVector<const QVector<int>*> lists;
+  QMap< QString, QVector<int> >::const_iterator it =
+      postings.lowerBound(prefix);
+  for (; it != postings.end() && it.key().startsWith(prefix); ++it) {
+    lists.append(&it.value());
+  }
+  if (lists.size() == 1 && limit < 0) {
+    return *lists.at(0);
+  }
+
+  // Entries are (id, list), smallest id on top; next[list] is where that
+  // list goes on.
+  QVector< QPair<int, int> > heap;
+  QVector<int> next(lists.size(), 1);
+  for (int i = 0; i < lists.size(); ++i) {
+    heap.append(qMakePair(lists.at(i)->at(0), i));
+  }
+  std::greater< QPair<int, int> > later;
+  std::make_heap(heap.begin(), heap.end(), later);
+  QVector<int> matches;
+  while (!heap.isEmpty() && matches.size() != limit) {
+    std::pop_heap(heap.begin(), heap.end(), later);
+    QPair<int, int> top = heap.last();
+    heap.remove(heap.size() - 1);
+    if (matches.isEmpty() || matches.last() != top.first) {
+      matches.append(top.first);
+    }
+    const QVector<int>& list = *lists.at(top.second);
+    if (next[top.second] < list.size()) {
+      heap.append(qMakePair(list.at(next[top.second]++), top.second));
+      std::push_heap(heap.begin(), heap.end(), later);
+    }
+  }
+  return matches;
+}
+
+// Files with all of 'tokens'; one ending in '*' is a prefix. A lone token
+// is all there is to the group, so it's only looked up as far as a reply
+// goes.
+QVector<int> SearchIndex::findAll(const QStringList& tokens) const {
+  int limit = (tokens.size() == 1) ? SEARCH_MAX_MATCHES : -1;
+  QVector< QVector<int> > lists;
+  for (const QString& token : tokens) {
+    if (token.endsWith('*')) {
+      lists.append(findPrefix(token.left(token.size() - 1), limit));
+    } else {
+      lists.append(postings.value(token));
+    }
+  }
+  std::sort(lists.begin(), lists.end(), shorter);
+  QVector<int> all = lists.at(0);
+  for (int i = 1; i < lists.size() && !all.isEmpty(); ++i) {
+    all = intersect(all, lists.at(i));
+  }
+  return all;
+}
+
+QVector<int> SearchIndex::findKeywords(const QString& query) const {
+  static const QRegExp whitespace("\\s+");
+  QStringList words = query.split(whitespace, QString::SkipEmptyParts);
+  QVector<int> matches;
+  // Tokens of the words since the last "or", prefixes ending in '*'.
+  QStringList group;
+  for (int w = 0; w <= words.size(); ++w) {
+    QString word = (w < words.size()) ? words.at(w).toLower() : "or";
+    if (word == "or") {
+      if (!group.isEmpty()) {
+        matches = unite(matches, findAll(group), SEARCH_MAX_MATCHES);
+      }
+      group.clear();
+      continue;
+    }
+    if (word == "and") {
+      continue;
+    }
+
+    QStringList tokens = tokenize(word);
+    if (word.endsWith('*') && !tokens.isEmpty()) {
+      tokens.last().append('*');
+    }
+    group += tokens;
+  }
+  return matches;
+}
+
+// The characters a pattern matches literally up to its first bit of regex
+// syntax. Empty if alternation could make even that optional.
+static QString literalPrefix(const QString& pattern) {
+  static const QString regexSyntax("\\.[](){}?+*^$|");
+  if (pattern.contains('|')) {
+    return QString();
+  }
+  int i = 0;
+  while (i < pattern.size() && !regexSyntax.contains(pattern.at(i))) {
+    ++i;
+  }
+  // A quantifier applies to the character before it.
+  if (i > 0 && i < pattern.size()
+      && (pattern.at(i) == '?' || pattern.at(i) == '*'
+          || pattern.at(i) == '{')) {
+    --i;
+  }
+  return pattern.left(i);
+}
+
+QVector<int> SearchIndex::findRegex(const QString& query) {
+  QVector<int> matches;
+  if (query.size() > SEARCH_MAX_PATTERN) {
+    return matches;
+  }
+  if (!regexCache.contains(query)) {
+    if (regexCache.size() >= SEARCH_REGEX_CACHE) {
+      regexCache.clear();
+    }
+    regexCache.insert(query, QRegExp(query));
+  }
+  QRegExp regex = regexCache.value(query);
+  if (!regex.isValid()) {
+    return matches;
+  }
+
+  QString prefix = literalPrefix(query);
+  QMap< QString, QVector<int> >::const_iterator it = byName.lowerBound(prefix);
+  for (int scanned = 0; it != byName.constEnd() && it.key().startsWith(prefix)
+                        && scanned < SEARCH_MAX_SCANNED; ++it, ++scanned) {
+    if (regex.exactMatch(it.key())) {
+      matches += it.value();
+    }
+  }
+  std::sort(matches.begin(), matches.end());
+  return matches;
+}
+
+QStringList SearchIndex::find(const QString& query) {
+  QVector<int> matches;
+  if (isKeywordQuery(query)) {
+    keywordQueries++;
+    matches = findKeywords(query);
+  } else {
+    regexQueries++;
+    matches = findRegex(query);
+  }
+  QStringList fileNames;
+  for (int i = 0; i < matches.size() && i < SEARCH_MAX_MATCHES; ++i) {
+    fileNames.append(names.at(matches.at(i)));
+  }
+  return fileNames;
+}
+
+int SearchIndex::fileCount() const {
+  return numFiles;
+}
+
+int SearchIndex::tokenCount() const {
+  return postings.size();
+}
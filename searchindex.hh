@@ -0,0 +1,73 @@
+#ifndef PEERSTER_SEARCHINDEX_HH
+#define PEERSTER_SEARCHINDEX_HH
+
+#include <QHash>
+#include <QMap>
+#include <QRegExp>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// At most this many files answer one search; a reply has to fit in a
+// datagram.
+#define SEARCH_MAX_MATCHES 200
+// Regex queries: compiled patterns kept, the longest pattern accepted, and
+// the most names one query is matched against.
+#define SEARCH_REGEX_CACHE 32
+#define SEARCH_MAX_PATTERN 256
+#define SEARCH_MAX_SCANNED 4096
+
+// Finds shared files by name. Names are split into lowercase tokens at
+// anything that isn't a letter or digit ("My_Notes.txt" is "my", "notes",
+// "txt"), and each token maps to the sorted ids of the files that have it.
+// Tokens are kept in order, so a prefix is a range of them.
+//
+// A keyword query is words, each matching files with all its tokens, with
+// "and" and "or" between them; "and" binds tighter and is implied. A word
+// ending in '*' matches its last token as a prefix. So "foo bar* or baz"
+// finds files with "foo" and a token starting with "bar", and files with
+// "baz". Words are intersected shortest list first, and no more than
+// SEARCH_MAX_MATCHES ids are collected for a prefix or a union.
+//
+// Anything with other regex syntax is matched against whole names with
+// QRegExp::exactMatch, as searches always were, but only against the names
+// that start with the pattern's literal prefix. Queries come off the
+// network, so a regex is tried on at most SEARCH_MAX_SCANNED names; one
+// with no literal prefix only sees the first of them in name order.
+//
+// Files are added and removed one at a time, as they're shared.
+class SearchIndex {
+public:
+  SearchIndex();
+
+  void addFile(const QString& fileName);
+  void removeFile(const QString& fileName);
+  // Full paths of shared files matching 'query', oldest share first.
+  QStringList find(const QString& query);
+
+  int fileCount() const;
+  int tokenCount() const;
+
+  static bool isKeywordQuery(const QString& query);
+  static QStringList tokenize(const QString& name);
+
+  quint64 keywordQueries;
+  quint64 regexQueries;
+
+private:
+  QVector<int> findKeywords(const QString& query) const;
+  QVector<int> findAll(const QStringList& tokens) const;
+  QVector<int> findRegex(const QString& query);
+  QVector<int> findPrefix(const QString& prefix, int limit) const;
+
+  // Full paths by id; ids aren't reused, so a removed file leaves a null.
+  QVector<QString> names;
+  QHash<QString, int> ids;
+  QMap< QString, QVector<int> > postings;
+  // File names without their directory, for regex queries.
+  QMap< QString, QVector<int> > byName;
+  QHash<QString, QRegExp> regexCache;
+  int numFiles;
+};
+
+#endif // PEERSTER_SEARCHINDEX_HH
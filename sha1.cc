@@ -0,0 +1,251 @@
+#include <cstring>
+
+#include "sha1.hh"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA1_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+typedef void (*CompressFunction)(quint32* state, const unsigned char* data,
+                                  qint64 chunks);
+
+static inline quint32 rotl(quint32 x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+static void compressPortable(quint32* state, const unsigned char* data,
+                             qint64 chunks) {
+  for (; chunks > 0; --chunks, data += 64) {
+    quint32 w[80];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = ((quint32) data[4 * i] << 24) | ((quint32) data[4 * i + 1] << 16)
+             | ((quint32) data[4 * i + 2] << 8) | data[4 * i + 3];
+    }
+    for (int i = 16; i < 80; ++i) {
+      w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    quint32 a = state[0], b = state[1], c = state[2], d = state[3],
+            e = state[4];
+#define SHA1_STEP(f, k, i)                                                  \
+    do {                                                                    \
+      quint32 t = rotl(a, 5) + (f) + e + (k) + w[(i)];                      \
+      e = d;                                                                \
+      d = c;                                                                \
+      c = rotl(b, 30);                                                      \
+      b = a;                                                                \
+      a = t;                                                                \
+    } while (0)
+    for (int i = 0; i < 20; ++i) {
+      SHA1_STEP((b & c) | (~b & d), 0x5A827999, i);
+    }
+    for (int i = 20; i < 40; ++i) {
+      SHA1_STEP(b ^ c ^ d, 0x6ED9EBA1, i);
+    }
+    for (int i = 40; i < 60; ++i) {
+      SHA1_STEP((b & c) | (b & d) | (c & d), 0x8F1BBCDC, i);
+    }
+    for (int i = 60; i < 80; ++i) {
+      SHA1_STEP(b ^ c ^ d, 0xCA62C1D6, i);
+    }
+#undef SHA1_STEP
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+  }
+}
+
+#ifdef SHA1_X86
+// Four rounds with the SHA extensions. Message words for later rounds are
+// computed four at a time in m[0..3], used round robin; 'g' is the group of
+// four rounds (0..19), so every condition below is decided at compile time.
+#define SHA1_ROUNDS(g, eCur, eNext)                                         \
+  do {                                                                      \
+    if ((g) < 4) {                                                          \
+      m[(g)] = _mm_shuffle_epi8(                                            \
+          _mm_loadu_si128((const __m128i*) (data + 16 * (g))), byteSwap);   \
+    }                                                                       \
+    if ((g) == 0) {                                                         \
+      eCur = _mm_add_epi32(eCur, m[0]);                                     \
+    } else {                                                                \
+      eCur = _mm_sha1nexte_epu32(eCur, m[(g) % 4]);                         \
+    }                                                                       \
+    eNext = abcd;                                                           \
+    if ((g) >= 3 && (g) <= 18) {                                            \
+      m[((g) + 1) % 4] = _mm_sha1msg2_epu32(m[((g) + 1) % 4], m[(g) % 4]);  \
+    }                                                                       \
+    abcd = _mm_sha1rnds4_epu32(abcd, eCur, (g) / 5);                        \
+    if ((g) >= 1 && (g) <= 16) {                                            \
+      m[((g) + 3) % 4] = _mm_sha1msg1_epu32(m[((g) + 3) % 4], m[(g) % 4]);  \
+    }                                                                       \
+    if ((g) >= 2 && (g) <= 17) {                                            \
+      m[((g) + 2) % 4] = _mm_xor_si128(m[((g) + 2) % 4], m[(g) % 4]);       \
+    }                                                                       \
+  } while (0)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void compressShaNi(quint32* state, const unsigned char* data,
+                          qint64 chunks) {
+  const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607LL,
+                                          0x08090a0b0c0d0e0fLL);
+  __m128i abcd = _mm_shuffle_epi32(
+      _mm_loadu_si128((const __m128i*) state), 0x1B);
+  __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+  __m128i e1;
+  __m128i m[4];
+
+  for (; chunks > 0; --chunks, data += 64) {
+    __m128i abcdSaved = abcd;
+    __m128i e0Saved = e0;
+    SHA1_ROUNDS(0, e0, e1);
+    SHA1_ROUNDS(1, e1, e0);
+    SHA1_ROUNDS(2, e0, e1);
+    SHA1_ROUNDS(3, e1, e0);
+    SHA1_ROUNDS(4, e0, e1);
+    SHA1_ROUNDS(5, e1, e0);
+    SHA1_ROUNDS(6, e0, e1);
+    SHA1_ROUNDS(7, e1, e0);
+    SHA1_ROUNDS(8, e0, e1);
+    SHA1_ROUNDS(9, e1, e0);
+    SHA1_ROUNDS(10, e0, e1);
+    SHA1_ROUNDS(11, e1, e0);
+    SHA1_ROUNDS(12, e0, e1);
+    SHA1_ROUNDS(13, e1, e0);
+    SHA1_ROUNDS(14, e0, e1);
+    SHA1_ROUNDS(15, e1, e0);
+    SHA1_ROUNDS(16, e0, e1);
+    SHA1_ROUNDS(17, e1, e0);
+    SHA1_ROUNDS(18, e0, e1);
+    SHA1_ROUNDS(19, e1, e0);
+    e0 = _mm_sha1nexte_epu32(e0, e0Saved);
+    abcd = _mm_add_epi32(abcd, abcdSaved);
+  }
+
+  _mm_storeu_si128((__m128i*) state, _mm_shuffle_epi32(abcd, 0x1B));
+  state[4] = _mm_extract_epi32(e0, 3);
+}
+
+static bool cpuHasShaNi() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)
+      || !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+    return false;
+  }
+  if (__get_cpuid_max(0, NULL) < 7) {
+    return false;
+  }
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return (ebx & (1 << 29)) != 0;
+}
+#endif
+
+static CompressFunction bestCompress() {
+#ifdef SHA1_X86
+  if (cpuHasShaNi()) {
+    return compressShaNi;
+  }
+#endif
+  return compressPortable;
+}
+
+static CompressFunction compress = bestCompress();
+
+Sha1::Sha1() {
+  clear();
+}
+
+void Sha1::clear() {
+  state[0] = 0x67452301;
+  state[1] = 0xEFCDAB89;
+  state[2] = 0x98BADCFE;
+  state[3] = 0x10325476;
+  state[4] = 0xC3D2E1F0;
+  buffered = 0;
+  length = 0;
+}
+
+void Sha1::update(const char* data, qint64 size) {
+  const unsigned char* p = (const unsigned char*) data;
+  length += size;
+  if (buffered > 0) {
+    int n = (int) qMin((qint64) (64 - buffered), size);
+    memcpy(buffer + buffered, p, n);
+    buffered += n;
+    p += n;
+    size -= n;
+    if (buffered < 64) {
+      return;
+    }
+    compress(state, buffer, 1);
+    buffered = 0;
+  }
+  // Whole chunks are hashed straight from the caller's memory.
+  if (size >= 64) {
+    compress(state, p, size / 64);
+    p += size & ~(qint64) 63;
+    size &= 63;
+  }
+  memcpy(buffer, p, size);
+  buffered = (int) size;
+}
+
+void Sha1::update(const QByteArray& data) {
+  update(data.constData(), data.size());
+}
+
+void Sha1::final(char* out) {
+  quint64 bits = length * 8;
+  buffer[buffered++] = 0x80;
+  if (buffered > 56) {
+    memset(buffer + buffered, 0, 64 - buffered);
+    compress(state, buffer, 1);
+    buffered = 0;
+  }
+  memset(buffer + buffered, 0, 56 - buffered);
+  for (int i = 0; i < 8; ++i) {
+    buffer[56 + i] = (unsigned char) (bits >> (56 - 8 * i));
+  }
+  compress(state, buffer, 1);
+
+  for (int i = 0; i < 5; ++i) {
+    out[4 * i] = (char) (state[i] >> 24);
+    out[4 * i + 1] = (char) (state[i] >> 16);
+    out[4 * i + 2] = (char) (state[i] >> 8);
+    out[4 * i + 3] = (char) state[i];
+  }
+  clear();
+}
+
+QByteArray Sha1::final() {
+  QByteArray digest(SHA1_SIZE, Qt::Uninitialized);
+  final(digest.data());
+  return digest;
+}
+
+QByteArray Sha1::hash(const QByteArray& data) {
+  Sha1 sha1;
+  sha1.update(data);
+  return sha1.final();
+}
+
+void Sha1::hashBlocks(const char* data, qint64 size, int blockSize,
+                      char* out) {
+  Sha1 sha1;
+  for (qint64 offset = 0; offset < size; offset += blockSize) {
+    sha1.update(data + offset, qMin((qint64) blockSize, size - offset));
+    sha1.final(out);
+    out += SHA1_SIZE;
+  }
+}
+
+bool Sha1::accelerated() {
+  return compress != compressPortable;
+}
+
+void Sha1::setAccelerated(bool on) {
+  compress = on ? bestCompress() : compressPortable;
+}
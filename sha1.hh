@@ -0,0 +1,42 @@
+#ifndef PEERSTER_SHA1_HH
+#define PEERSTER_SHA1_HH
+
+#include <QByteArray>
+
+#define SHA1_SIZE 20
+
+// SHA-1, which names every block, index page and file. It uses the CPU's
+// SHA extensions where there are any and plain C++ otherwise. Unlike
+// QCA::Hash it needs no provider lookup, so contexts are cheap to make and
+// to reuse.
+class Sha1 {
+public:
+  Sha1();
+
+  void clear();
+  void update(const char* data, qint64 size);
+  void update(const QByteArray& data);
+  // Writes the digest to 'out' and clears the context.
+  void final(char* out);
+  QByteArray final();
+
+  static QByteArray hash(const QByteArray& data);
+  // Hashes 'size' bytes as consecutive blocks of 'blockSize' bytes (the
+  // last one may be shorter) and writes their digests to 'out' back to
+  // back, the way a metafile lists them.
+  static void hashBlocks(const char* data, qint64 size, int blockSize,
+                         char* out);
+
+  // Whether the SHA extensions are used. They're on by default if the CPU
+  // has them; turning them off is for comparing the two.
+  static bool accelerated();
+  static void setAccelerated(bool on);
+
+private:
+  quint32 state[5];
+  unsigned char buffer[64];
+  int buffered;
+  quint64 length;
+};
+
+#endif // PEERSTER_SHA1_HH
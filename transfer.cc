@@ -0,0 +1,626 @@
+#include <cmath>
+#include <cstdio>
+
+#include <QDataStream>
+#include <QtAlgorithms>
+
+#include "merkle.hh"
+#include "transfer.hh"
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+SourceWindow::SourceWindow(const QString& origin, int maxWindow) {
+  this->origin = origin;
+  this->maxWindow = maxWindow;
+  srtt = 0;
+  rttvar = 0;
+  rto = RTO_INITIAL_MS;
+  haveRtt = false;
+  received = 0;
+  timeouts = 0;
+  missed = 0;
+  cwnd = qMin(WINDOW_INITIAL, maxWindow);
+  ssthresh = maxWindow;
+  lastDecrease = -RTO_MAX_MS;
+}
+
+bool SourceWindow::hasRoom() const {
+  // A stalled source only gets one request at a time, as a probe.
+  return outstanding.size() < (isStalled() ? 1 : (int) cwnd);
+}
+
+bool SourceWindow::isStalled() const {
+  return missed >= SOURCE_STALL_TIMEOUTS;
+}
+
+double SourceWindow::rate() const {
+  // Without a sample yet, RTO_INITIAL_MS is a pessimistic RTT.
+  return cwnd / qMax(haveRtt ? srtt : (double) rto, 1.0);
+}
+
+void SourceWindow::sent(int index, qint64 now) {
+  OutstandingRequest o;
+  o.sentAt = now;
+  o.retransmitted = failed.contains(index);
+  outstanding.insert(index, o);
+}
+
+void SourceWindow::ack(int index, qint64 now) {
+  received++;
+  missed = 0;
+  // A late reply to a request that already timed out still counts, but it
+  // doesn't say anything reliable about the RTT.
+  if (outstanding.contains(index)) {
+    OutstandingRequest o = outstanding.take(index);
+    if (!o.retransmitted) {
+      sampleRtt(now - o.sentAt);
+    }
+  }
+
+  if (cwnd < ssthresh) {
+    cwnd += 1;
+  } else {
+    cwnd += 1 / cwnd;
+  }
+  if (cwnd > maxWindow) {
+    cwnd = maxWindow;
+  }
+}
+
+void SourceWindow::cancel(int index) {
+  outstanding.remove(index);
+}
+
+QList<int> SourceWindow::expire(qint64 now) {
+  QList<int> list;
+  QHash<int, OutstandingRequest>::iterator it = outstanding.begin();
+  while (it != outstanding.end()) {
+    if (now - it.value().sentAt >= rto) {
+      list.append(it.key());
+      failed.insert(it.key());
+      it = outstanding.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (list.isEmpty()) {
+    return list;
+  }
+
+  // A burst of losses from one window only shrinks the window once.
+  if (now - lastDecrease >= qMax((qint64) srtt, (qint64) RTO_MIN_MS)) {
+    timeouts++;
+    missed++;
+    ssthresh = qMax(cwnd / 2, 2.0);
+    cwnd = qMax(cwnd / 2, 1.0);
+    rto = qMin(rto * 2, (qint64) RTO_MAX_MS);
+    lastDecrease = now;
+  }
+  return list;
+}
+
+void SourceWindow::sampleRtt(qint64 rtt) {
+  if (!haveRtt) {
+    srtt = rtt;
+    rttvar = rtt / 2.0;
+    haveRtt = true;
+  } else {
+    rttvar = 0.75 * rttvar + 0.25 * fabs(srtt - rtt);
+    srtt = 0.875 * srtt + 0.125 * rtt;
+  }
+  rto = (qint64) (srtt + qMax(4 * rttvar, (double) TRANSFER_TICK_MS));
+  rto = qBound((qint64) RTO_MIN_MS, rto, (qint64) RTO_MAX_MS);
+}
+
+BlockWindow::BlockWindow(int numBlocks, int maxWindow) {
+  this->maxWindow = maxWindow;
+  this->numBlocks = 0;
+  received = 0;
+  nextIndex = 0;
+  retransmits = 0;
+  grow(numBlocks);
+}
+
+BlockWindow::~BlockWindow() {
+  qDeleteAll(sources);
+}
+
+void BlockWindow::addSource(const QString& origin) {
+  if (source(origin) == NULL) {
+    sources.append(new SourceWindow(origin, maxWindow));
+  }
+}
+
+QList<BlockRequest> BlockWindow::nextRequests(qint64 now) {
+  QList<BlockRequest> list;
+  QList<SourceWindow*> order = bySpeed();
+  for (SourceWindow* s : order) {
+    while (s->hasRoom()) {
+      // Blocks a resumed transfer already has are done before they're ever
+      // handed out.
+      while (nextIndex < numBlocks && done.at(nextIndex)) {
+        ++nextIndex;
+      }
+      int index;
+      if (takeRetry(s, &index)) {
+        // Taken off the retry list.
+      } else if (nextIndex < numBlocks) {
+        index = nextIndex++;
+      } else if (!takeEndgame(s, &index)) {
+        break;
+      }
+
+      s->sent(index, now);
+      copies[index]++;
+      BlockRequest r;
+      r.index = index;
+      r.origin = s->origin;
+      list.append(r);
+    }
+  }
+  return list;
+}
+
+bool BlockWindow::ack(int index, const QString& origin, qint64 now) {
+  if (index < 0 || index >= numBlocks || done.at(index)) {
+    return false;
+  }
+  done[index] = true;
+  received++;
+  copies[index] = 0;
+
+  // Whoever else still has it outstanding is off the hook.
+  SourceWindow* from = source(origin);
+  for (SourceWindow* s : sources) {
+    if (s != from) {
+      s->cancel(index);
+    }
+  }
+  if (from != NULL) {
+    from->ack(index, now);
+  }
+  return true;
+}
+
+int BlockWindow::expire(qint64 now) {
+  int count = 0;
+  for (SourceWindow* s : sources) {
+    QList<int> expired = s->expire(now);
+    for (int index : expired) {
+      copies[index]--;
+      if (!done.at(index) && copies.at(index) == 0) {
+        retry.append(index);
+      }
+    }
+    count += expired.size();
+  }
+  retransmits += count;
+  return count;
+}
+
+void BlockWindow::markDone(int index) {
+  if (!done.at(index)) {
+    done[index] = true;
+    received++;
+  }
+}
+
+void BlockWindow::grow(int count) {
+  numBlocks += count;
+  while (done.size() < numBlocks) {
+    done.append(false);
+    copies.append(0);
+  }
+}
+
+bool BlockWindow::isComplete() const {
+  return received == numBlocks;
+}
+
+int BlockWindow::inFlight() const {
+  int count = 0;
+  for (SourceWindow* s : sources) {
+    count += s->outstanding.size();
+  }
+  return count;
+}
+
+double BlockWindow::totalWindow() const {
+  double sum = 0;
+  for (SourceWindow* s : sources) {
+    sum += s->cwnd;
+  }
+  return sum;
+}
+
+SourceWindow* BlockWindow::source(const QString& origin) const {
+  for (SourceWindow* s : sources) {
+    if (s->origin == origin) {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+static bool fasterThan(const SourceWindow* a, const SourceWindow* b) {
+  if (a->isStalled() != b->isStalled()) {
+    return b->isStalled();
+  }
+  return a->rate() > b->rate();
+}
+
+// Live sources fastest first, then stalled ones.
+QList<SourceWindow*> BlockWindow::bySpeed() const {
+  QList<SourceWindow*> list = sources;
+  qStableSort(list.begin(), list.end(), fasterThan);
+  return list;
+}
+
+// The first block waiting for a retransmission that 's' hasn't already
+// failed on, unless every source has.
+bool BlockWindow::takeRetry(SourceWindow* s, int* index) {
+  for (int i = 0; i < retry.size(); ++i) {
+    int candidate = retry.at(i);
+    if (done.at(candidate) || copies.at(candidate) > 0) {
+      retry.removeAt(i--);
+      continue;
+    }
+    if (s->failed.contains(candidate)) {
+      bool otherSource = false;
+      for (SourceWindow* other : sources) {
+        if (!other->failed.contains(candidate) && !other->isStalled()) {
+          otherSource = true;
+          break;
+        }
+      }
+      if (otherSource) {
+        continue;
+      }
+    }
+    retry.removeAt(i);
+    *index = candidate;
+    return true;
+  }
+  return false;
+}
+
+// End game: an idle source asks for the block that's been outstanding the
+// longest somewhere else. Each block is asked of at most two sources.
+bool BlockWindow::takeEndgame(SourceWindow* s, int* index) {
+  if (!s->outstanding.isEmpty() || s->isStalled()) {
+    return false;
+  }
+  int oldest = -1;
+  qint64 oldestSentAt = 0;
+  for (SourceWindow* other : sources) {
+    QHash<int, OutstandingRequest>::const_iterator it;
+    for (it = other->outstanding.constBegin();
+         it != other->outstanding.constEnd(); ++it) {
+      if (copies.at(it.key()) == 1
+          && (oldest < 0 || it.value().sentAt < oldestSentAt)) {
+        oldest = it.key();
+        oldestSentAt = it.value().sentAt;
+      }
+    }
+  }
+  if (oldest < 0) {
+    return false;
+  }
+  *index = oldest;
+  return true;
+}
+
+Transfer::Transfer(QString fileName, QString uploader,
+                   QByteArray metafileHash, int maxWindow) {
+  this->fileName = fileName;
+  this->uploader = uploader;
+  this->metafileHash = metafileHash;
+  window = new BlockWindow(0, maxWindow);
+  window->addSource(uploader);
+  part = new QFile(fileName + ".part");
+  numBlocks = 0;
+  blocksReceived = 0;
+  fileSize = 0;
+  resumed = false;
+  dirty = true;
+  savedAt = 0;
+  startedAt = 0;
+  reportedPercent = 0;
+  addItem(metafileHash, ITEM_ROOT, 0);
+  window->grow(1);
+}
+
+Transfer::~Transfer() {
+  delete part;
+  delete window;
+}
+
+// "PSTS", for "peerster transfer state".
+#define STATE_MAGIC 0x50535453
+#define STATE_VERSION 1
+
+Transfer* Transfer::load(const QString& statePath, int maxWindow) {
+  QFile f(statePath);
+  if (!f.open(QIODevice::ReadOnly)) {
+    return NULL;
+  }
+  QDataStream in(&f);
+  quint32 magic, version;
+  QString fileName, uploader;
+  QByteArray metafileHash;
+  QStringList sources;
+  qint64 fileSize;
+  QBitArray present;
+  in >> magic >> version;
+  if (magic != STATE_MAGIC || version != STATE_VERSION) {
+    return NULL;
+  }
+  in >> fileName >> metafileHash >> uploader >> sources >> fileSize
+     >> present;
+  if (in.status() != QDataStream::Ok || metafileHash.size() != 20) {
+    return NULL;
+  }
+
+  Transfer* t = new Transfer(fileName, uploader, metafileHash, maxWindow);
+  for (const QString& origin : sources) {
+    t->addSource(origin);
+  }
+  t->fileSize = fileSize;
+  t->present = present;
+  t->resumed = true;
+  t->dirty = false;
+  return t;
+}
+
+bool Transfer::open() {
+  QIODevice::OpenMode mode = QIODevice::ReadWrite;
+  if (!resumed) {
+    mode |= QIODevice::Truncate;
+  }
+  if (!part->open(mode)) {
+    error = "can't open " + part->fileName() + ": " + part->errorString();
+    return false;
+  }
+  return true;
+}
+
+bool Transfer::save(qint64 now) {
+  savedAt = now;
+  if (!part->flush()) {
+    return false;
+  }
+#ifdef Q_OS_UNIX
+  // The state file mustn't claim blocks a crash could still lose.
+  fdatasync(part->handle());
+#endif
+
+  QStringList sources;
+  for (SourceWindow* s : window->sources) {
+    sources.append(s->origin);
+  }
+  QString tmpPath = statePath() + ".tmp";
+  QFile f(tmpPath);
+  if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    return false;
+  }
+  QDataStream out(&f);
+  out << (quint32) STATE_MAGIC << (quint32) STATE_VERSION;
+  out << fileName << metafileHash << uploader << sources << fileSize
+      << present;
+  if (out.status() != QDataStream::Ok || !f.flush()) {
+    return false;
+  }
+  f.close();
+  QFile::remove(statePath());
+  if (!QFile::rename(tmpPath, statePath())) {
+    return false;
+  }
+  dirty = false;
+  return true;
+}
+
+void Transfer::addSource(const QString& origin) {
+  window->addSource(origin);
+  dirty = true;
+}
+
+int Transfer::received(int index, const QByteArray& data) {
+  dropHash(index);
+
+  int level = itemLevels.at(index);
+  if (level == ITEM_BLOCK) {
+    qint64 offset = (qint64) itemPositions.at(index) * 8192;
+    if (!part->seek(offset) || part->write(data) != data.size()) {
+      error = "can't write " + part->fileName() + ": " + part->errorString();
+      return 0;
+    }
+    blocksReceived++;
+    fileSize = qMax(fileSize, offset + data.size());
+    present.setBit(itemPositions.at(index));
+    dirty = true;
+    return 0;
+  }
+
+  QByteArray entries = data;
+  int childLevel = level - 1;
+  if (level == ITEM_ROOT) {
+    childLevel = MerkleTree::parseRoot(data, &entries) - 1;
+    if (childLevel < 0) {
+      error = "bad root index page";
+      return 0;
+    }
+  } else if (entries.size() > 20 * MERKLE_FANOUT) {
+    entries.truncate(20 * MERKLE_FANOUT);
+  }
+
+  int count = entries.size() / 20;
+  int first = (level == ITEM_ROOT) ? 0
+                                   : itemPositions.at(index) * MERKLE_FANOUT;
+  int firstItem = itemHashes.size();
+  for (int i = 0; i < count; ++i) {
+    addItem(entries.mid(20 * i, 20), childLevel, first + i);
+  }
+  window->grow(count);
+  if (childLevel != ITEM_BLOCK) {
+    return count;
+  }
+
+  if (first + count > numBlocks) {
+    // Reserve the space up front; on most file systems this leaves a hole
+    // the blocks are written into.
+    numBlocks = first + count;
+    if (part->size() < (qint64) numBlocks * 8192) {
+      part->resize((qint64) numBlocks * 8192);
+    }
+    if (present.size() < numBlocks) {
+      present.resize(numBlocks);
+    }
+  }
+  // Blocks a previous run already saved don't need fetching again. Their
+  // hashes are dropped, so the manager never routes them to us.
+  if (resumed) {
+    for (int i = firstItem; i < itemHashes.size(); ++i) {
+      if (present.testBit(itemPositions.at(i))) {
+        window->markDone(i);
+        blocksReceived++;
+        dropHash(i);
+      }
+    }
+  }
+  return count;
+}
+
+QByteArray Transfer::itemHash(int index) const {
+  return itemHashes.at(index);
+}
+
+QList<int> Transfer::indicesOf(const QByteArray& hash) const {
+  return itemIndex.value(hash);
+}
+
+// Every page has been fetched once every item has, so there's nothing left
+// to discover.
+bool Transfer::isComplete() const {
+  return window->isComplete();
+}
+
+bool Transfer::commit() {
+  // The last block is usually short.
+  if (!part->resize(fileSize) || !part->flush()) {
+    error = "can't finish " + part->fileName() + ": " + part->errorString();
+    return false;
+  }
+#ifdef Q_OS_UNIX
+  fsync(part->handle());
+#endif
+  part->close();
+  QFile::remove(statePath());
+
+#ifdef Q_OS_UNIX
+  // rename() replaces an existing file in one step.
+  if (::rename(QFile::encodeName(part->fileName()).constData(),
+               QFile::encodeName(fileName).constData()) != 0) {
+    error = "can't rename " + part->fileName() + ": " + strerror(errno);
+    return false;
+  }
+#else
+  QFile::remove(fileName);
+  if (!part->rename(fileName)) {
+    error = "can't rename " + part->fileName() + ": " + part->errorString();
+    return false;
+  }
+#endif
+  return true;
+}
+
+void Transfer::discard() {
+  part->close();
+  part->remove();
+  QFile::remove(statePath());
+}
+
+QString Transfer::statePath() const {
+  return fileName + ".part.state";
+}
+
+// The hash isn't needed once the item is in; big files have a lot of them.
+void Transfer::dropHash(int index) {
+  QList<int>& same = itemIndex[itemHashes.at(index)];
+  same.removeOne(index);
+  if (same.isEmpty()) {
+    itemIndex.remove(itemHashes.at(index));
+  }
+  itemHashes[index] = QByteArray();
+}
+
+void Transfer::addItem(const QByteArray& hash, int level, int position) {
+  itemIndex[hash].append(itemHashes.size());
+  itemHashes.append(hash);
+  itemLevels.append(level);
+  itemPositions.append(position);
+}
+
+TransferManager::~TransferManager() {
+  qDeleteAll(transfers);
+}
+
+Transfer* TransferManager::find(const QByteArray& metafileHash) const {
+  return transfers.value(metafileHash);
+}
+
+void TransferManager::add(Transfer* t) {
+  transfers.insert(t->metafileHash, t);
+  itemsAdded(t, 0);
+}
+
+void TransferManager::itemsAdded(Transfer* t, int first) {
+  for (int i = first; i < t->itemHashes.size(); ++i) {
+    if (t->itemHashes.at(i).isEmpty()) {
+      continue;
+    }
+    QList<Transfer*>& list = byBlock[t->itemHashes.at(i)];
+    if (!list.contains(t)) {
+      list.append(t);
+    }
+  }
+}
+
+void TransferManager::itemDone(Transfer* t, const QByteArray& hash) {
+  if (t->itemIndex.contains(hash)) {
+    return;
+  }
+  QList<Transfer*>& list = byBlock[hash];
+  list.removeAll(t);
+  if (list.isEmpty()) {
+    byBlock.remove(hash);
+  }
+}
+
+void TransferManager::remove(Transfer* t) {
+  QList<QByteArray> hashes = t->itemIndex.keys();
+  for (const QByteArray& hash : hashes) {
+    QList<Transfer*>& list = byBlock[hash];
+    list.removeAll(t);
+    if (list.isEmpty()) {
+      byBlock.remove(hash);
+    }
+  }
+  transfers.remove(t->metafileHash);
+}
+
+QList<Transfer*> TransferManager::waitingFor(const QByteArray& blockHash)
+    const {
+  return byBlock.value(blockHash);
+}
+
+QList<Transfer*> TransferManager::all() const {
+  return transfers.values();
+}
+
+bool TransferManager::isEmpty() const {
+  return transfers.isEmpty();
+}
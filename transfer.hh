@@ -0,0 +1,250 @@
+#ifndef PEERSTER_TRANSFER_HH
+#define PEERSTER_TRANSFER_HH
+
+#include <QBitArray>
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+// Block requests a transfer starts out with per source, and the default
+// cap. The cap can be changed with "-window <n>".
+#define WINDOW_INITIAL 2
+#define WINDOW_DEFAULT_MAX 32
+
+// Retransmission timeout bounds, in ms. Until there's an RTT sample the
+// timeout is RTO_INITIAL_MS.
+#define RTO_INITIAL_MS 1000
+#define RTO_MIN_MS 100
+#define RTO_MAX_MS 8000
+
+// How often outstanding requests are checked for timeouts.
+#define TRANSFER_TICK_MS 50
+
+// How often a transfer's progress is saved, at most.
+#define TRANSFER_SAVE_MS 1000
+
+// Timeouts in a row, with no reply in between, after which a source counts
+// as stalled.
+#define SOURCE_STALL_TIMEOUTS 3
+
+class OutstandingRequest {
+public:
+  qint64 sentAt;
+  bool retransmitted;
+};
+
+// Outstanding block requests to one source. The window grows like TCP's
+// congestion window: by one per reply in slow start, then by one per
+// window's worth of replies, and halves on timeouts (at most once per RTT).
+// Each request has its own timeout, derived from a smoothed RTT as in
+// RFC 6298; replies to requests this source already timed out on aren't
+// used as RTT samples.
+class SourceWindow {
+public:
+  SourceWindow(const QString& origin, int maxWindow);
+
+  bool hasRoom() const;
+  bool isStalled() const;
+  // Estimated blocks per ms.
+  double rate() const;
+  void sent(int index, qint64 now);
+  // A verified reply from this source, whether or not the request was still
+  // outstanding here.
+  void ack(int index, qint64 now);
+  // Drops a request another source has answered.
+  void cancel(int index);
+  // Takes requests older than the timeout off the window and returns them.
+  QList<int> expire(qint64 now);
+
+  QString origin;
+  int maxWindow;
+  double cwnd;
+  double ssthresh;
+  double srtt;
+  double rttvar;
+  qint64 rto;
+  bool haveRtt;
+  quint64 received;
+  quint64 timeouts;
+  // Timeouts since the last reply.
+  int missed;
+  QHash<int, OutstandingRequest> outstanding;
+  // Blocks that timed out here; they go to other sources if there are any.
+  QSet<int> failed;
+
+private:
+  void sampleRtt(qint64 rtt);
+
+  qint64 lastDecrease;
+};
+
+class BlockRequest {
+public:
+  int index;
+  QString origin;
+};
+
+// Schedules the blocks of one transfer, numbered 0..numBlocks-1, over every
+// source that has the file; more can be added as they're discovered. Each
+// source has its own window; blocks are handed out fastest source first, so
+// faster sources end up serving more of the file. Blocks that time out go
+// back in line for another source, and once there's nothing new left to ask
+// for, idle sources duplicate requests still outstanding at slower ones.
+class BlockWindow {
+public:
+  BlockWindow(int numBlocks, int maxWindow);
+  ~BlockWindow();
+
+  void addSource(const QString& origin);
+  // Blocks to request now and whom to ask. They count as outstanding from
+  // 'now' on.
+  QList<BlockRequest> nextRequests(qint64 now);
+  // A verified reply for block 'index' from 'origin'. Returns false if we
+  // already had it.
+  bool ack(int index, const QString& origin, qint64 now);
+  // Puts requests older than their source's timeout back in line and
+  // returns how many there were.
+  int expire(qint64 now);
+  // Adds 'count' blocks after the last one.
+  void grow(int count);
+  // Counts block 'index' as received without asking anyone for it. Only
+  // for blocks that haven't been requested yet.
+  void markDone(int index);
+  bool isComplete() const;
+  int inFlight() const;
+  // Sum of the sources' windows.
+  double totalWindow() const;
+
+  int numBlocks;
+  int received;
+  int maxWindow;
+  quint64 retransmits;
+  QList<SourceWindow*> sources;
+
+private:
+  SourceWindow* source(const QString& origin) const;
+  QList<SourceWindow*> bySpeed() const;
+  bool takeRetry(SourceWindow* s, int* index);
+  bool takeEndgame(SourceWindow* s, int* index);
+
+  QList<int> retry;
+  QVector<bool> done;
+  // How many sources each block is outstanding at.
+  QVector<int> copies;
+  int nextIndex;
+};
+
+// Item levels in a Transfer. Index pages are at level 1 and up.
+#define ITEM_BLOCK 0
+#define ITEM_ROOT -1
+
+// One download, from every origin known to have the file. Everything it
+// fetches is an item: the root index page, the pages below it, and the
+// blocks they list. Items are numbered in the order they're discovered,
+// which is also the order they're requested, so the pages below a page go
+// out before the blocks they lead to and blocks start flowing as soon as
+// the first level 1 page is in.
+//
+// Blocks may arrive in any order. Each is written at its offset in
+// "<file name>.part" as soon as it's verified, and the finished file is
+// renamed into place, so a transfer holds no file data in memory.
+//
+// Next to the part file, "<file name>.part.state" records the metafile
+// hash, the sources and which blocks are in the part file. A node that
+// restarts picks the transfer up from there: it fetches the index pages
+// again, but only the blocks it's missing.
+class Transfer {
+public:
+  Transfer(QString fileName, QString uploader, QByteArray metafileHash,
+           int maxWindow);
+  ~Transfer();
+
+  // A transfer saved in 'statePath', or NULL if it can't be read.
+  static Transfer* load(const QString& statePath, int maxWindow);
+
+  // Opens the part file, keeping what's in it if the transfer was loaded.
+  // Returns false (and sets 'error') if it can't.
+  bool open();
+  // Writes the state file, after making sure the blocks it lists are on
+  // disk.
+  bool save(qint64 now);
+  // Another origin with the same metafile hash.
+  void addSource(const QString& origin);
+  // Takes the verified data of item 'index'. For an index page, the items
+  // it lists are added to the end; returns how many. Sets 'error' if the
+  // data can't be used.
+  int received(int index, const QByteArray& data);
+  QByteArray itemHash(int index) const;
+  // All item indices with this hash (identical blocks share one).
+  QList<int> indicesOf(const QByteArray& hash) const;
+  bool isComplete() const;
+  // Trims the part file to size and renames it over 'fileName'.
+  bool commit();
+  // Closes and deletes the part file and the state file.
+  void discard();
+  QString statePath() const;
+
+  QString fileName;
+  // The origin named in the search result.
+  QString uploader;
+  QByteArray metafileHash;
+  BlockWindow* window;
+  // By item index.
+  QVector<QByteArray> itemHashes;
+  QVector<int> itemLevels;
+  // A block's number in the file, or a page's position on its level.
+  QVector<int> itemPositions;
+  // Hashes of the items not received yet.
+  QHash< QByteArray, QList<int> > itemIndex;
+  QFile* part;
+  // Blocks listed so far, and received.
+  int numBlocks;
+  int blocksReceived;
+  // End of the furthest block received; the file's size once all are in.
+  qint64 fileSize;
+  // Blocks in the part file, by block number.
+  QBitArray present;
+  // Whether the part file had blocks in it to begin with.
+  bool resumed;
+  // Whether 'present' changed since it was saved, and when that was.
+  bool dirty;
+  qint64 savedAt;
+  qint64 startedAt;
+  int reportedPercent;
+  QString error;
+
+private:
+  void addItem(const QByteArray& hash, int level, int position);
+  void dropHash(int index);
+};
+
+// All downloads in progress, keyed by metafile hash. Replies only carry the
+// hash of the item they answer, so the manager also indexes every hash a
+// transfer is waiting for.
+class TransferManager {
+public:
+  ~TransferManager();
+
+  Transfer* find(const QByteArray& metafileHash) const;
+  void add(Transfer* t);
+  // Indexes the items of 't' from 'first' on, after Transfer::received()
+  // has added them.
+  void itemsAdded(Transfer* t, int first);
+  // Stops routing 'hash' to 't' once it has every item with that hash.
+  void itemDone(Transfer* t, const QByteArray& hash);
+  // Forgets 't' without deleting it.
+  void remove(Transfer* t);
+  QList<Transfer*> waitingFor(const QByteArray& blockHash) const;
+  QList<Transfer*> all() const;
+  bool isEmpty() const;
+
+private:
+  QHash<QByteArray, Transfer*> transfers;
+  QHash< QByteArray, QList<Transfer*> > byBlock;
+};
+
+#endif // PEERSTER_TRANSFER_HH
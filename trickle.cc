@@ -0,0 +1,43 @@
+#include <cstdlib>
+
+#include "trickle.hh"
+
+TrickleTimer::TrickleTimer(qint64 minMs, qint64 maxMs, qint64 now)
+    : minMs(minMs), maxMs(maxMs) {
+  resets = 0;
+  firings = 0;
+  length = minMs;
+  start = now;
+  pick();
+}
+
+void TrickleTimer::pick() {
+  qint64 half = length / 2;
+  fireAt = start + half + rand() % qMax(half, (qint64) 1);
+}
+
+bool TrickleTimer::reset(qint64 now) {
+  if (length == minMs) {
+    return false;
+  }
+  length = minMs;
+  start = now;
+  pick();
+  resets++;
+  return true;
+}
+
+qint64 TrickleTimer::due() const {
+  return fireAt;
+}
+
+void TrickleTimer::fired() {
+  firings++;
+  start += length;
+  length = qMin(length * 2, maxMs);
+  pick();
+}
+
+qint64 TrickleTimer::interval() const {
+  return length;
+}
@@ -0,0 +1,47 @@
+#ifndef PEERSTER_TRICKLE_HH
+#define PEERSTER_TRICKLE_HH
+
+#include <QtGlobal>
+
+// Bounds on the interval between our route rumors. The longest has to stay
+// well under ROUTE_STALE_MS, or neighbours' routes to us go stale.
+#define ROUTE_RUMOR_MIN_MS 1000
+#define ROUTE_RUMOR_MAX_MS 240000
+
+// A Trickle timer (RFC 6206), minus suppression: each origin's route
+// rumor is the only one of its kind, so there's nothing to suppress it in
+// favour of. Each interval fires once, at a random point in its second
+// half, and the next interval is twice as long, up to the maximum. A
+// change in the topology starts over at the minimum, so news goes out
+// quickly and a stable network hears from us less and less often. The
+// jitter keeps neighbours that saw the same change from firing together.
+//
+// The timer only keeps time; the caller arms a QTimer for due().
+class TrickleTimer {
+public:
+  TrickleTimer(qint64 minMs, qint64 maxMs, qint64 now);
+
+  // Starts over at the shortest interval, unless it's already there.
+  // Returns false if it was.
+  bool reset(qint64 now);
+  // When to fire next.
+  qint64 due() const;
+  // Fired at due(); moves on to the next interval.
+  void fired();
+
+  qint64 interval() const;
+
+  quint64 resets;
+  quint64 firings;
+
+private:
+  void pick();
+
+  qint64 minMs;
+  qint64 maxMs;
+  qint64 length;
+  qint64 start;
+  qint64 fireAt;
+};
+
+#endif // PEERSTER_TRICKLE_HH
@@ -0,0 +1,153 @@
+#include <QDirIterator>
+#include <QFile>
+
+#include "crypto.hh"
+#include "sha1.hh"
+#include "workers.hh"
+
+EngineJob::EngineJob(NetSocket* sock) {
+  this->sock = sock;
+  // The engine deletes jobs once they're finished, not the pool.
+  setAutoDelete(false);
+}
+
+void EngineJob::run() {
+  work();
+  sock->completeJob(this);
+}
+
+PendingFile::PendingFile(QString fileName, qint64 numBytes) {
+  this->fileName = fileName;
+  this->numBytes = numBytes;
+  int numBlocks = (int) ((numBytes + 8191) / 8192);
+  numChunks = (numBlocks + INDEX_CHUNK_BLOCKS - 1) / INDEX_CHUNK_BLOCKS;
+  metafile = QByteArray(20 * numBlocks, Qt::Uninitialized);
+  metafileData = metafile.data();
+  chunksLeft = numChunks;
+  failed = false;
+  chunksFinished = 0;
+  bytesHashed = 0;
+  reportedPercent = 0;
+  if (numChunks == 0) {
+    pages = MerkleTree::build(metafile);
+  }
+}
+
+HashChunkJob::HashChunkJob(NetSocket* sock, PendingFile* file, int chunk)
+    : EngineJob(sock) {
+  this->file = file;
+  this->chunk = chunk;
+  bytesRead = 0;
+}
+
+void HashChunkJob::work() {
+  qint64 offset = (qint64) chunk * INDEX_CHUNK_BLOCKS * 8192;
+  qint64 expected = qMin((qint64) INDEX_CHUNK_BLOCKS * 8192,
+                         file->numBytes - offset);
+  QByteArray data;
+  QFile f(file->fileName);
+  if (f.open(QIODevice::ReadOnly) && f.seek(offset)) {
+    data = f.read(expected);
+  }
+  bytesRead = data.size();
+  if (bytesRead != expected) {
+    // The file changed under us; the engine drops it.
+    file->failed = true;
+  }
+
+  int first = chunk * INDEX_CHUNK_BLOCKS;
+  Sha1::hashBlocks(data.constData(), bytesRead, 8192,
+                   file->metafileData + 20 * first);
+  f.close();
+
+  if (--file->chunksLeft == 0) {
+    file->pages = MerkleTree::build(file->metafile);
+  }
+}
+
+void HashChunkJob::finish() {
+  sock->chunkHashed(file, bytesRead);
+}
+
+WalkDirectoryJob::WalkDirectoryJob(NetSocket* sock, QString path)
+    : EngineJob(sock) {
+  this->path = path;
+}
+
+void WalkDirectoryJob::work() {
+  QDirIterator it(path, QDir::Files | QDir::Readable,
+                  QDirIterator::Subdirectories);
+  while (it.hasNext()) {
+    fileNames.append(it.next());
+  }
+}
+
+void WalkDirectoryJob::finish() {
+  qDebug() << "sharing" << fileNames.size() << "files under" << path;
+  for (const QString& fileName : fileNames) {
+    sock->addFile(fileName);
+  }
+}
+
+ReadBlockJob::ReadBlockJob(NetSocket* sock, QVariantMap* map,
+                           QString fileName, int index)
+    : EngineJob(sock) {
+  this->map = map;
+  this->fileName = fileName;
+  this->index = index;
+}
+
+void ReadBlockJob::work() {
+  sock->fileStore->readBlock(fileName, index, &block);
+  dataHash = Sha1::hash(block.data);
+}
+
+void ReadBlockJob::finish() {
+  sock->finishBlockReply(map, block.data, dataHash);
+}
+
+VerifyBlockJob::VerifyBlockJob(NetSocket* sock, QVariantMap* map)
+    : EngineJob(sock) {
+  this->map = map;
+}
+
+void VerifyBlockJob::work() {
+  QByteArray data = map->value("Data").toByteArray();
+  dataHash = Sha1::hash(data);
+}
+
+void VerifyBlockJob::finish() {
+  sock->handleBlockReply(map, dataHash);
+}
+
+DecryptJob::DecryptJob(NetSocket* sock, QString origin, QString cipherText)
+    : EngineJob(sock) {
+  this->origin = origin;
+  this->cipherText = cipherText.toUtf8().constData();
+  privKey = sock->priv_key;
+  n = sock->n;
+}
+
+void DecryptJob::work() {
+  plainText = QString::fromUtf8(rsa_decrypt(cipherText, privKey, n).c_str());
+}
+
+void DecryptJob::finish() {
+  sock->sink->privateMessageReceived(origin, plainText);
+}
+
+EncryptJob::EncryptJob(NetSocket* sock, QString origin, QString plainText)
+    : EngineJob(sock) {
+  this->origin = origin;
+  this->plainText = plainText.toUtf8().constData();
+  pubKey = sock->cryptoKeys->value(origin).first.toUtf8().constData();
+  n = sock->cryptoKeys->value(origin).second.toUtf8().constData();
+}
+
+void EncryptJob::work() {
+  cipherText = QString::fromUtf8(rsa_encrypt(plainText, pubKey, n).c_str());
+}
+
+void EncryptJob::finish() {
+  sock->sendPrivateRumor(origin, cipherText);
+}
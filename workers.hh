@@ -0,0 +1,135 @@
+#ifndef PEERSTER_WORKERS_HH
+#define PEERSTER_WORKERS_HH
+
+#include <atomic>
+#include <string>
+
+#include <QByteArray>
+#include <QRunnable>
+#include <QString>
+#include <QVariantMap>
+
+#include "netsocket.hh"
+
+using namespace std;
+
+// CPU- or disk-heavy work the engine hands to its thread pool. work() runs
+// on a pool thread and must only touch the job's own members; finish() runs
+// afterwards on the engine thread and applies the result. The engine
+// deletes the job after finish().
+class EngineJob : public QRunnable {
+public:
+  EngineJob(NetSocket* sock);
+  void run();
+
+  virtual void work() = 0;
+  virtual void finish() = 0;
+
+  NetSocket* sock;
+};
+
+// Blocks hashed by one HashChunkJob, read from the file in one go (1 MB).
+#define INDEX_CHUNK_BLOCKS 128
+
+// A file being shared. Its chunks are hashed in parallel, each into its own
+// slice of the metafile; the engine publishes the file once all of them are
+// in.
+class PendingFile {
+public:
+  PendingFile(QString fileName, qint64 numBytes);
+
+  QString fileName;
+  qint64 numBytes;
+  int numChunks;
+  // Sized up front; workers write their slices through metafileData.
+  QByteArray metafile;
+  char* metafileData;
+  // Chunks still hashing. Whoever hashes the last one also builds the
+  // index pages.
+  atomic<int> chunksLeft;
+  atomic<bool> failed;
+  QList<MerklePage> pages;
+  // The rest is only touched on the engine thread.
+  int chunksFinished;
+  qint64 bytesHashed;
+  int reportedPercent;
+};
+
+// Hashes INDEX_CHUNK_BLOCKS blocks of a file being shared.
+class HashChunkJob : public EngineJob {
+public:
+  HashChunkJob(NetSocket* sock, PendingFile* file, int chunk);
+  void work();
+  void finish();
+
+  PendingFile* file;
+  int chunk;
+  qint64 bytesRead;
+};
+
+// Lists the files under a shared directory, recursively, and shares each.
+class WalkDirectoryJob : public EngineJob {
+public:
+  WalkDirectoryJob(NetSocket* sock, QString path);
+  void work();
+  void finish();
+
+  QString path;
+  QStringList fileNames;
+};
+
+// Reads one block of a shared file and sends it back as a block reply.
+// 'map' is the request, already turned around by sendBlockReply(). Both
+// the read and the hash happen here, off the engine's thread.
+class ReadBlockJob : public EngineJob {
+public:
+  ReadBlockJob(NetSocket* sock, QVariantMap* map, QString fileName, int index);
+  void work();
+  void finish();
+
+  QVariantMap* map;
+  QString fileName;
+  int index;
+  FileBlock block;
+  QByteArray dataHash;
+};
+
+// Hashes the data of an incoming block reply before handleBlockReply()
+// checks it.
+class VerifyBlockJob : public EngineJob {
+public:
+  VerifyBlockJob(NetSocket* sock, QVariantMap* map);
+  void work();
+  void finish();
+
+  QVariantMap* map;
+  QByteArray dataHash;
+};
+
+class DecryptJob : public EngineJob {
+public:
+  DecryptJob(NetSocket* sock, QString origin, QString cipherText);
+  void work();
+  void finish();
+
+  QString origin;
+  string cipherText;
+  string privKey;
+  string n;
+  QString plainText;
+};
+
+class EncryptJob : public EngineJob {
+public:
+  EncryptJob(NetSocket* sock, QString origin, QString plainText);
+  void work();
+  void finish();
+
+  QString origin;
+  string plainText;
+  string pubKey;
+  string n;
+  QString cipherText;
+};
+
+#endif // PEERSTER_WORKERS_HH